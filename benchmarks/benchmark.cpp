@@ -0,0 +1,313 @@
+// Native benchmark of the solver, without the Python overhead of
+// connectpy.Benchmark. Build with `make benchmark`, then run from the root of
+// the project (the Test_* files are downloaded by
+// download_benchmark_files.sh):
+//
+//     benchmarks/benchmark [--json results.json] [--dir benchmarks]
+//                          [--threads N] [--micro-only] [Test_L3_R1 ...]
+//
+// Solves the positions of each suite with the weak and the strong solver
+// (with N threads, 1 by default, to measure the Lazy SMP scaling),
+// checks the scores, and reports the latency (mean and percentiles), the
+// explored positions and the speed. Microbenchmarks then time the Board and
+// TranspositionTable primitives. With --json, the results are also written
+// as JSON, to track regressions between versions.
+#include "../connectpy/connectlib.h"
+
+#include <cstdlib>
+#include <random>
+
+#ifndef CONNECTLIB_VERSION
+#define CONNECTLIB_VERSION "unknown"
+#endif
+
+
+struct SuiteResult {
+    std::string name;
+    bool weak;
+    size_t positions;
+    double mean_seconds;
+    double p50_seconds;
+    double p90_seconds;
+    double p99_seconds;
+    double max_seconds;
+    double mean_explored_pos;
+    double mpos_per_second;
+};
+
+struct MicroResult {
+    std::string name;
+    double ns_per_op;
+};
+
+
+// Reads the (sequence, score) lines of a suite. Returns false if the file
+// cannot be read.
+bool readSuite(const std::string& filename,
+               std::vector<std::pair<std::string, int>>& positions) {
+    std::ifstream file(filename);
+    if (!file)
+        return false;
+    std::string sequence;
+    int score;
+    while (file >> sequence >> score)
+        positions.push_back(std::make_pair(sequence, score));
+    return true;
+}
+
+// Value of the sorted durations below which a fraction of them are.
+double percentile(const std::vector<double>& sorted, double fraction) {
+    size_t i = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[i];
+}
+
+SuiteResult runSuite(const std::string& name,
+                     const std::vector<std::pair<std::string, int>>& positions,
+                     bool weak, int threads) {
+    Solver solver(threads);
+    std::vector<double> seconds;
+    uint64_t explored_pos = 0;
+    for (const auto& position : positions) {
+        Board B(position.first);
+        solver.reset();
+        auto start = std::chrono::steady_clock::now();
+        int score = solver.dichotomicSolve(B, weak);
+        seconds.push_back(std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count());
+        explored_pos += solver.getNumExploredPos();
+        int expected = position.second;
+        if (weak)
+            expected = (expected > 0) - (expected < 0);
+        if (score != expected) {
+            std::cerr << name << ": wrong score " << score << " for "
+                      << position.first << " (expected " << expected << ")"
+                      << std::endl;
+            std::exit(1);
+        }
+    }
+
+    SuiteResult result;
+    result.name = name;
+    result.weak = weak;
+    result.positions = seconds.size();
+    double total_seconds = 0;
+    for (double s : seconds)
+        total_seconds += s;
+    std::sort(seconds.begin(), seconds.end());
+    result.mean_seconds = total_seconds / seconds.size();
+    result.p50_seconds = percentile(seconds, 0.5);
+    result.p90_seconds = percentile(seconds, 0.9);
+    result.p99_seconds = percentile(seconds, 0.99);
+    result.max_seconds = seconds.back();
+    result.mean_explored_pos = double(explored_pos) / seconds.size();
+    result.mpos_per_second = explored_pos / total_seconds * 1e-6;
+    return result;
+}
+
+
+// Boards reached by random games, some of them finished.
+std::vector<Board> randomBoards(size_t count, std::mt19937_64& rng) {
+    std::vector<Board> boards;
+    while (boards.size() < count) {
+        Board B;
+        int moves = rng() % (Board::WIDTH * Board::HEIGHT);
+        for (int i = 0; i < moves && B.getStatus() == GameStatus::InProgress;
+                ++i) {
+            int col = rng() % Board::WIDTH;
+            if (B.canPlay(col))
+                B.play(col);
+        }
+        boards.push_back(B);
+    }
+    return boards;
+}
+
+// Times op(i) for i in [0, count), repeated until it runs for a while.
+template <class Op>
+MicroResult runMicro(const std::string& name, size_t count, Op op) {
+    uint64_t repeats = 0;
+    auto start = std::chrono::steady_clock::now();
+    double seconds;
+    do {
+        for (size_t i = 0; i < count; ++i)
+            op(i);
+        ++repeats;
+        seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+    } while (seconds < 0.5);
+    MicroResult result;
+    result.name = name;
+    result.ns_per_op = seconds * 1e9 / (repeats * count);
+    return result;
+}
+
+std::vector<MicroResult> runMicros() {
+    const size_t count = 1 << 16;
+    std::mt19937_64 rng(42);
+    std::vector<Board> boards = randomBoards(count, rng);
+    // Playable columns of the boards in progress, to replay them.
+    std::vector<Board> playable_boards;
+    std::vector<int> playable_cols;
+    for (const Board& B : boards) {
+        for (int col = 0; col < Board::WIDTH; ++col) {
+            if (B.canPlay(col)) {
+                playable_boards.push_back(B);
+                playable_cols.push_back(col);
+                break;
+            }
+        }
+    }
+    std::vector<uint64_t> keys(count);
+    for (size_t i = 0; i < count; ++i)
+        keys[i] = boards[i].key();
+
+    // Results are accumulated in sink so that the operations are not
+    // optimized away.
+    volatile uint64_t sink = 0;
+    std::vector<MicroResult> results;
+    results.push_back(runMicro("Board::play", playable_boards.size(),
+        [&](size_t i) {
+            Board B(playable_boards[i]);
+            B.play(playable_cols[i]);
+            sink = sink + B.key();
+        }));
+    results.push_back(runMicro("Board::winMask", count, [&](size_t i) {
+            sink = sink + boards[i].winMask();
+        }));
+    results.push_back(runMicro("Board::candidatesMask", count, [&](size_t i) {
+            sink = sink + boards[i].candidatesMask();
+        }));
+    results.push_back(runMicro("Board(key)", count, [&](size_t i) {
+            sink = sink + Board(keys[i]).getMoves();
+        }));
+
+    // A table much larger than the caches, as in the search.
+    TranspositionTable table((64 << 20) / sizeof(uint64_t));
+    results.push_back(runMicro("TranspositionTable::put", count,
+        [&](size_t i) {
+            table.put(keys[i], static_cast<int8_t>(i),
+                      TranspositionTable::NO_LOWER_BOUND, boards[i].getMoves());
+        }));
+    results.push_back(runMicro("TranspositionTable::get", count,
+        [&](size_t i) {
+            sink = sink + table.get(keys[i]).second;
+        }));
+    return results;
+}
+
+
+void printText(const std::vector<SuiteResult>& suites,
+               const std::vector<MicroResult>& micros) {
+    std::printf("%-20s %8s %11s %11s %11s %11s %13s %8s\n", "suite",
+                "solver", "mean", "p50", "p90", "p99", "mean pos",
+                "Mpos/s");
+    for (const SuiteResult& r : suites) {
+        std::printf("%-20s %8s %9.3fms %9.3fms %9.3fms %9.3fms %13.1f %8.2f\n",
+                    r.name.c_str(), r.weak ? "weak" : "strong",
+                    r.mean_seconds * 1e3, r.p50_seconds * 1e3,
+                    r.p90_seconds * 1e3, r.p99_seconds * 1e3,
+                    r.mean_explored_pos, r.mpos_per_second);
+    }
+    if (!suites.empty() && !micros.empty())
+        std::printf("\n");
+    for (const MicroResult& r : micros)
+        std::printf("%-28s %8.2f ns/op\n", r.name.c_str(), r.ns_per_op);
+}
+
+void writeJson(const std::string& filename, int threads,
+               const std::vector<SuiteResult>& suites,
+               const std::vector<MicroResult>& micros) {
+    std::ofstream file(filename);
+    file.precision(9);
+    file << "{\n";
+    file << "  \"version\": \"" << CONNECTLIB_VERSION << "\",\n";
+    file << "  \"threads\": " << threads << ",\n";
+#ifdef CONNECTLIB_STATS
+    file << "  \"stats\": true,\n";
+#else
+    file << "  \"stats\": false,\n";
+#endif
+    file << "  \"suites\": [";
+    for (size_t i = 0; i < suites.size(); ++i) {
+        const SuiteResult& r = suites[i];
+        file << (i ? ",\n" : "\n")
+             << "    {\"name\": \"" << r.name << "\", "
+             << "\"solver\": \"" << (r.weak ? "weak" : "strong") << "\", "
+             << "\"positions\": " << r.positions << ", "
+             << "\"mean_seconds\": " << r.mean_seconds << ", "
+             << "\"p50_seconds\": " << r.p50_seconds << ", "
+             << "\"p90_seconds\": " << r.p90_seconds << ", "
+             << "\"p99_seconds\": " << r.p99_seconds << ", "
+             << "\"max_seconds\": " << r.max_seconds << ", "
+             << "\"mean_explored_pos\": " << r.mean_explored_pos << ", "
+             << "\"mpos_per_second\": " << r.mpos_per_second << "}";
+    }
+    file << (suites.empty() ? "],\n" : "\n  ],\n");
+    file << "  \"micro\": [";
+    for (size_t i = 0; i < micros.size(); ++i) {
+        file << (i ? ",\n" : "\n")
+             << "    {\"name\": \"" << micros[i].name << "\", "
+             << "\"ns_per_op\": " << micros[i].ns_per_op << "}";
+    }
+    file << (micros.empty() ? "]\n" : "\n  ]\n");
+    file << "}\n";
+    if (!file) {
+        std::cerr << "Cannot write " << filename << std::endl;
+        std::exit(1);
+    }
+}
+
+
+int main(int argc, char** argv) {
+    std::string json_filename;
+    std::string directory = "benchmarks";
+    bool micro_only = false;
+    int threads = 1;
+    std::vector<std::string> names;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--json" && i + 1 < argc) {
+            json_filename = argv[++i];
+        } else if (arg == "--dir" && i + 1 < argc) {
+            directory = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = std::atoi(argv[++i]);
+            if (threads <= 0) {
+                std::cerr << "Invalid number of threads" << std::endl;
+                return 2;
+            }
+        } else if (arg == "--micro-only") {
+            micro_only = true;
+        } else if (arg.compare(0, 2, "--") == 0) {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 2;
+        } else {
+            names.push_back(arg);
+        }
+    }
+    if (names.empty()) {
+        names = {"Test_L3_R1", "Test_L2_R1", "Test_L2_R2",
+                 "Test_L1_R1", "Test_L1_R2", "Test_L1_R3"};
+    }
+
+    std::vector<SuiteResult> suites;
+    if (!micro_only) {
+        for (const std::string& name : names) {
+            std::vector<std::pair<std::string, int>> positions;
+            if (!readSuite(directory + "/" + name, positions)
+                    || positions.empty()) {
+                std::cerr << "Skipping " << name << ": cannot read "
+                          << directory << "/" << name << std::endl;
+                continue;
+            }
+            suites.push_back(runSuite(name, positions, true, threads));
+            suites.push_back(runSuite(name, positions, false, threads));
+        }
+    }
+    std::vector<MicroResult> micros = runMicros();
+
+    printText(suites, micros);
+    if (!json_filename.empty())
+        writeJson(json_filename, threads, suites, micros);
+    return 0;
+}
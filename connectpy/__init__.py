@@ -1,14 +1,33 @@
 from . import connectlib as cpp
 from .connectlib import Board
+from .connectlib import BoardBatch
 from .connectlib import GameStatus
 from .connectlib import OpeningBook
+from .connectlib import PNSolver
+from .connectlib import Ponderer
 from .connectlib import Solver
 from .connectlib import TranspositionTable
+from .connectlib import export_positions
+from .connectlib import solve_many
 
 import os
+import tempfile
 import time
 import sys
 
+def load_opening_book():
+    # The bundled book is compressed, which requires a build with zlib.
+    # Otherwise, it has to be decompressed with "gunzip -k" first.
+    path = os.path.join(os.path.dirname(os.path.realpath(__file__)),
+                        "opening_book_8.bin")
+    try:
+        return OpeningBook(path + ".gz")
+    except RuntimeError:
+        if not os.path.exists(path):
+            raise
+        return OpeningBook(path)
+
+
 class Benchmark:
     def __init__(self):
         self.load_benchmarks()
@@ -76,12 +95,10 @@ class Benchmark:
 class InteractiveGame:
     def __init__(self):
         self.board = Board()
-        self.solver = Solver()
-        opening_book_path = os.path.join(
-            os.path.dirname(os.path.realpath(__file__)),
-            "opening_book_8.bin")
-        self.opening_book = OpeningBook(opening_book_path)
-        self._score_by_key = dict()
+        self.opening_book = load_opening_book()
+        # Analyses are cached by the ponderer, which also solves the replies
+        # of the displayed board while the player is thinking.
+        self.ponderer = Ponderer(book=self.opening_book)
         self._undo_states = [self.board.key()]
         self._undo_ix = 0
         try:
@@ -137,11 +154,9 @@ class InteractiveGame:
             chr(0xff10 + i) if self.board.canPlay(i) else "\u3000"
             for i in range(1, 8)))
         if self.board.status == GameStatus.InProgress:
-            play_scores = []
-            for i in range(1, 8):
-                self._print_score_line(play_scores, is_computing=True)
-                play_scores.append(self.play_score(i))
-            self._print_score_line(play_scores, is_computing=False)
+            self._print_score_line([], is_computing=True)
+            self._print_score_line(self.play_scores(), is_computing=False)
+            self.ponderer.ponder(self.board)
         print()
 
     def _print_score_line(self, play_scores, is_computing):
@@ -186,24 +201,9 @@ class InteractiveGame:
         i = input(f">>> Are you sure you want to {action}? (y/n) ")
         return i.lower() in ("y", "yes")
 
-    def score(self, key):
-        if key not in self._score_by_key:
-            b = Board(key)
-            if b.moves <= self.opening_book.depth:
-                (is_found, score) = self.opening_book[b]
-                assert is_found, key
-            else:
-                score = self.solver.dichotomicSolve(b)
-            self._score_by_key[key] = score
-        return self._score_by_key[key]
-
-    def play_score(self, col):
-        if not self.board.canPlay(col):
-            return None
-        b = Board(self.board.key())
-        b.play(col)
-        # Negative score because point of view of current player:
-        return -self.score(b.key())
+    def play_scores(self):
+        # Scores of each column, from the point of view of current player.
+        return self.ponderer.analyze(self.board)
 
     def _read_single_key_with_termios(self):
         import termios, tty
@@ -265,12 +265,178 @@ def test_Board():
         "OXOXOXO   draw"])
     _other_asserts(board3)
 
+    # Keys of boards of more than 64 cells are larger Python integers.
+    board4 = cpp.Board9x7("999999")
+    assert board4.key() >= 2 ** 64
+    assert cpp.Board9x7(board4.key()).key() == board4.key()
+
+def test_BoardBatch():
+    # numpy is only needed by the batch functions.
+    try:
+        import numpy as np
+    except ImportError:
+        return
+    sequences = ["", "4455", "445532", "1122112211"]
+    batch = BoardBatch(np.array([Board(s).key() for s in sequences],
+                                dtype=np.uint64))
+    batch.play(np.array([4, 0, 6, 3]))
+    boards = [Board(s) for s in ["4", "4455", "4455326", "11221122113"]]
+    assert list(batch.key()) == [b.key() for b in boards]
+    assert list(batch.symmetricKey()) == [b.symmetricKey() for b in boards]
+    assert list(batch.moves) == [b.moves for b in boards]
+    assert list(batch.status) == [int(b.status) for b in boards]
+    assert list(batch.canPlay(1)) == [b.canPlay(1) for b in boards]
+    assert [repr(batch[i]) for i in range(len(batch))] == [
+        repr(b) for b in boards]
+    # Nothing is played if any move is not allowed.
+    try:
+        batch.play(np.array([4, 4, 4, 1]))
+        assert False
+    except RuntimeError:
+        pass
+    assert list(batch.key()) == [b.key() for b in boards]
+
 def test_TranspositionTable():
-    t = TranspositionTable(10)
+    # Smaller tables could not tell apart keys with the same lowest 32 bits.
+    try:
+        TranspositionTable(16)
+        assert False
+    except RuntimeError:
+        pass
+    # 131071 buckets of 8 entries: key k goes to the bucket k % 131071.
+    t = TranspositionTable(1 << 20)
+    assert len(t) == 8 * 131071
     for i in range(13):
         t[i] = 10 * (i - 8)
     assert [(i, t[i]) for i in range(15)] == [
-        (0, (False,  0)), (1, (False,  0)), (2, (False,  0)), (3, (True, -50)),
+        (0, (True, -80)), (1, (True, -70)), (2, (True, -60)), (3, (True, -50)),
         (4, (True, -40)), (5, (True, -30)), (6, (True, -20)), (7, (True, -10)),
         (8, (True,   0)), (9, (True,  10)), (10, (True, 20)), (11, (True, 30)),
         (12, (True, 40)), (13, (False, 0)), (14, (False, 0))]
+    assert t[2 << 32] == (False, 0)
+    # In a full bucket, the entry with the most moves is replaced first.
+    t.reset()
+    for i in range(20):
+        t.put(131071 * i, i, moves=i)
+    assert [i for i in range(20) if t[131071 * i][0]] == [
+        0, 1, 2, 3, 4, 5, 6, 19]
+    # Snapshots can be loaded in a table of the same size.
+    with tempfile.TemporaryDirectory() as directory:
+        filename = os.path.join(directory, "table.snapshot")
+        t.save(filename)
+        t2 = TranspositionTable(1 << 20)
+        t2.load(filename)
+        assert [i for i in range(20) if t2[131071 * i][0]] == [
+            0, 1, 2, 3, 4, 5, 6, 19]
+        # Tables opening the same shared memory segment share their entries.
+        name = "/connectpy-test-%d" % (os.getpid(),)
+        try:
+            # Invalid solvers do not leave a segment of another size behind.
+            for (threads, tt_mib) in [(0, 64), (1, 4)]:
+                try:
+                    Solver(threads=threads, tt_mib=tt_mib, shared_tt=name)
+                    assert False
+                except RuntimeError:
+                    pass
+            t3 = TranspositionTable(1 << 20, shared=name)
+            t4 = TranspositionTable(1 << 20, shared=name)
+            t3.load(filename)
+            assert [i for i in range(20) if t4[131071 * i][0]] == [
+                0, 1, 2, 3, 4, 5, 6, 19]
+            t4[1] = 5
+            assert t3[1] == (True, 5)
+        finally:
+            TranspositionTable.unlink_shared(name)
+
+def test_Solver():
+    # Helpers must not change the results of the search.
+    positions = [("274117256453467", -3), ("741211565175563226", -2),
+                 ("472621346135177164", 1)]
+    s1 = Solver(threads=1, tt_mib=8)
+    s4 = Solver(threads=4, tt_mib=8)
+    assert (s1.threads, s4.threads) == (1, 4)
+    for (sequence, score) in positions:
+        for s in [s1, s4]:
+            s.reset()
+            assert s.dichotomicSolve(Board(sequence)) == score, sequence
+            assert s.dichotomicSolve(Board(sequence), True) == \
+                (score > 0) - (score < 0), sequence
+            assert s.solve(Board(sequence))[:2] == (score, score), sequence
+        assert s1.analyze(Board(sequence)) == s4.analyze(Board(sequence)), \
+            sequence
+    sequences = [sequence for (sequence, _) in positions]
+    assert list(solve_many(sequences, threads=1, tt_mib=8)) == \
+        list(solve_many(sequences, threads=4, tt_mib=8)) == \
+        [score for (_, score) in positions]
+    p = Ponderer(threads=2, tt_mib=8)
+    for sequence in sequences:
+        assert p.analyze(Board(sequence)) == s1.analyze(Board(sequence)), \
+            sequence
+    # Analyzing the board being pondered waits for its analysis instead of
+    # restarting it. The children of b are pondered from the middle column.
+    b = Board("761263226")
+    p.ponder(b)
+    time.sleep(0.05)
+    b.play(4)
+    assert p.analyze(b) == s1.analyze(b)
+    assert p.num_cancelled == 0
+    # A cancellation only stops the search it targets, which then leaves
+    # the score unbounded.
+    s4.cancel(s4.next_search_id)
+    assert s4.solve(Board())[:2] == (-21, 21)
+    assert s4.solve(Board(positions[0][0]))[:2] == (-3, -3)
+
+def test_PNSolver():
+    s = PNSolver(tt_mib=8)
+    # Won and lost positions, as found by the weak solver, and a finished
+    # game.
+    for (sequence, score) in [("4455", 1), ("44556", -1),
+                              ("324416175", 1), ("153576215", -1),
+                              ("4455667", -1)]:
+        assert s.solve(Board(sequence)) == score, sequence
+    assert s.solve(Board("4444445"), max_nodes=1000) is None
+
+def test_export_positions():
+    try:
+        import numpy as np
+    except ImportError:
+        return
+    o = load_opening_book()
+    with tempfile.TemporaryDirectory() as directory:
+        filename = os.path.join(directory, "positions.npy")
+        # 1, 4, 25 and 121 unique positions after 0, 1, 2 and 3 moves.
+        assert export_positions(filename, 3, threads=2, tt_mib=8,
+                                book=o) == 151
+        records = np.load(filename)
+    assert len(set(records["key"])) == 151
+    assert [(records["moves"] == i).sum() for i in range(4)] == [1, 4, 25, 121]
+    for record in records:
+        board = Board(int(record["key"]))
+        assert o[board] == (True, record["score"])
+        for col in range(1, 8):
+            if board.canPlay(col):
+                child = Board(board.key())
+                child.play(col)
+                assert record["move_scores"][col - 1] == -o[child][1]
+            else:
+                assert record["move_scores"][col - 1] == 127
+
+def test_OpeningBook():
+    o = load_opening_book()
+    assert (o.depth, len(o), o.weak) == (8, 130811, False)
+    boards = [Board(), Board("23"), Board("4455"), Board("123456712")]
+    assert [o[b] for b in boards] == [
+        (True, 1), (True, -1), (True, 18), (False, 0)]
+    # The compact format keeps the scores, or only their sign when weak.
+    with tempfile.TemporaryDirectory() as directory:
+        o.dump_compact(os.path.join(directory, "book.c4b"))
+        o2 = OpeningBook(os.path.join(directory, "book.c4b"))
+        assert (o2.depth, len(o2), o2.weak) == (8, 130811, False)
+        assert [o2[b] for b in boards] == [o[b] for b in boards]
+        o.dump_compact(os.path.join(directory, "book_weak.c4b"), weak=True)
+        o3 = OpeningBook(os.path.join(directory, "book_weak.c4b"))
+        assert o3.weak
+        assert [o3[b] for b in boards] == [
+            (True, 1), (True, -1), (True, 1), (False, 0)]
+        # The books map their files, which must be closed before removal.
+        del o2, o3
@@ -1,8 +1,15 @@
-from . import test_Board, test_TranspositionTable, InteractiveGame
+from . import test_Board, test_BoardBatch, test_OpeningBook, test_PNSolver
+from . import test_Solver, test_TranspositionTable, test_export_positions
+from . import InteractiveGame
 
 def main():
     test_Board()
+    test_BoardBatch()
     test_TranspositionTable()
+    test_Solver()
+    test_PNSolver()
+    test_OpeningBook()
+    test_export_positions()
     InteractiveGame().play()
 
 if __name__ == "__main__":
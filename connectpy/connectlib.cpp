@@ -1,633 +1,136 @@
-#include <algorithm>
-#include <fstream>
-#include <iostream>
-#include <set>
-#include <sstream>
-#include <sys/stat.h>
-#include <unordered_map>
-#include <vector>
+#include "connectlib.h"
 
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 namespace py = pybind11;
 
 
-// Must be defined outside of the class to be known at compile time.
-constexpr uint64_t _floorMask(int width, int height) {
-    return width == 0 ? 0
-        : _floorMask(width - 1, height)
-            | (UINT64_C(1) << (width - 1) * (height + 1));
-}
-
-class Board {
+#ifdef CONNECTLIB_HAS_UINT128
+// Conversion of 128-bit words from and to Python integers.
+namespace pybind11 {
+namespace detail {
+template <> struct type_caster<uint128_t> {
 public:
-    static const int WIDTH = 7;
-    static const int HEIGHT = 6;
-    static_assert(WIDTH < 10, "");
-    static_assert(WIDTH * (HEIGHT + 1) <= 64, "");
-
-    enum Status {
-        InProgress,
-        Draw,
-        Player1Wins,
-        Player2Wins,
-    };
-
-    Board() : mask_(0), position_(0), moves_(0), status_(Status::InProgress) {}
-
-    Board(std::string sequence) : Board() {
-        play(sequence);
-    }
-
-    Board(uint64_t key) {
-        uint64_t full = key + floorMask;
-        mask_ = 0;
-        position_ = 0;
-        for (int col = 0; col < WIDTH; ++col) {
-            bool has_stones = false;
-            for (int j = HEIGHT; j >= 0; --j) {
-                bool bit = (full & pointMask(col, j)) != 0;
-                if (!has_stones && !bit) {
-                    // No stone yet.
-                } else if (!has_stones && bit) {
-                    // Stones will start below.
-                    has_stones = true;
-                } else {
-                    mask_ |= pointMask(col, j);
-                    position_ |= full & pointMask(col, j);
-                }
-            }
-        }
-        moves_ = popcount(mask_);
-        if (hasAlignment(position_ ^ mask_)) {
-            status_ = (moves_ % 2) == 1 ? Status::Player1Wins : Status::Player2Wins;
-        } else if (moves_ == HEIGHT * WIDTH) {
-            status_ = Status::Draw;
-        } else {
-            status_ = Status::InProgress;
-        }
-    }
-
-    std::string toString() const {
-        static const std::string large_red_circle = "\xF0\x9F\x94\xB4";
-        static const std::string large_yellow_circle = "\xF0\x9F\x9F\xA1";
-        static const std::string white_square_button = "\xF0\x9F\x94\xB3";
-        std::ostringstream os;
-        for (int i = HEIGHT - 1; i >= 0; --i) {
-            for (int j = 0; j < WIDTH; ++j) {
-                uint64_t bitmask = UINT64_C(1) << i << j * (HEIGHT + 1);
-                if ((mask_ & bitmask) == 0) {
-                    os << white_square_button;
-                } else if (((position_ & bitmask) == 0) ^ ((moves_ % 2) == 0)) {
-                    os << large_red_circle;
-                } else {
-                    os << large_yellow_circle;
-                }
-            }
-            if (i == 1) {
-                os << "   " << moves_ << " moves";
-            } else if (i == 0 && status_ == Status::InProgress) {
-                os << "   "
-                   << (moves_ % 2 == 0 ? large_red_circle
-                                       : large_yellow_circle)
-                   << "'s turn";
-            } else if (i == 0 && status_ == Status::Draw) {
-                os << "   draw";
-            } else if (i == 0) {
-                os << "   winner: "
-                   << (status_ == Status::Player1Wins ? large_red_circle
-                                                      : large_yellow_circle);
-            }
-            if (i > 0)
-                os << "\n";
-        }
-        return os.str();
-    }
-
-    bool canPlay(int col) const {
-        return status_ == Status::InProgress && col >= 0 && col < WIDTH
-            && (mask_ & topMask(col)) == 0;
-    }
-
-    void assertCanPlay(int col) const {
-        if (canPlay(col))
-            return;
-        std::ostringstream os;
-        os << "Cannot play there (" << col << ").";
-        throw std::runtime_error(os.str());
-    }
-
-    void play(int col, bool check_alignment=true) {
-        position_ ^= mask_;
-        mask_ |= mask_ + bottomMask(col);
-
-        if (check_alignment && hasAlignment(position_ ^ mask_))
-            status_ = (moves_ % 2) == 0 ? Status::Player1Wins : Status::Player2Wins;
-
-        moves_++;
-
-        if (status_ == Status::InProgress && moves_ == HEIGHT * WIDTH)
-            status_ = Status::Draw;
-    }
-
-    void play(std::string sequence) {
-        for (unsigned int i = 0; i < sequence.size(); i++) {
-            int col = (int) (sequence[i] - '1'); // "1" -> 0, "2" -> 1, etc.
-            assertCanPlay(col);
-            play(col);
+    PYBIND11_TYPE_CASTER(uint128_t, const_name("int"));
+
+    bool load(handle src, bool) {
+        if (!PyLong_Check(src.ptr()))
+            return false;
+        object high = reinterpret_steal<object>(
+            PyNumber_Rshift(src.ptr(), int_(64).ptr()));
+        uint64_t high_bits = PyLong_AsUnsignedLongLong(high.ptr());
+        if (PyErr_Occurred()) {
+            // Negative or too large.
+            PyErr_Clear();
+            return false;
         }
+        value = static_cast<uint128_t>(high_bits) << 64
+            | PyLong_AsUnsignedLongLongMask(src.ptr());
+        return true;
     }
 
-    static bool hasAlignment(uint64_t pos) {
-        // Horizontal.
-        uint64_t m = pos & (pos << (HEIGHT + 1));
-        if (m & (m << (2 * (HEIGHT + 1))))
-            return true;
-        // Diagonal (\).
-        m = pos & (pos << HEIGHT);
-        if (m & (m << (2 * HEIGHT)))
-            return true;
-        // Diagonal (/).
-        m = pos & (pos << (HEIGHT + 2));
-        if (m & (m << (2 * (HEIGHT + 2))))
-            return true;
-        // Vertical.
-        m = pos & (pos << 1);
-        if (m & (m << 2))
-            return true;
-        // No alignment found.
-        return false;
-    }
-
-    bool isWinningMove(int col) const {
-        return hasAlignment(position_ | (
-            (mask_ + bottomMask(col)) & columnMask(col)));
-    }
-
-    uint64_t candidatesMask() const {
-        // All places where the current player can play.
-        uint64_t possible_moves = (mask_ + floorMask) & boardMask;
-
-        // We are forced to play where the opponent can win.
-        uint64_t opponent_win_mask = opponentWinMask();
-        uint64_t forced_mask = opponent_win_mask & possible_moves;
-        if (forced_mask) {
-            if (forced_mask & (forced_mask - 1)) {
-                // There are at least two forced moves. We cannot play anything.
-                return 0;
-            } else {
-                // We are forced to play to prevent the opponent from winning.
-                possible_moves = forced_mask;
-            }
-        }
-
-        // Do not play below opponent winning position.
-        possible_moves &= ~(opponent_win_mask >> 1);
-
-        return possible_moves;
-    }
-
-    uint64_t opponentWinMask() const {
-        return winMask(position_ ^ mask_, mask_);
-    }
-
-    uint64_t winMask() const {
-        return winMask(position_, mask_);
-    }
-
-    static uint64_t winMask(uint64_t pos, uint64_t mask) {
-        // Vertical.
-        uint64_t rv = (pos << 1) & (pos << 2) & (pos << 3);
-
-        // Horizontal.
-        uint64_t p = (pos << (HEIGHT + 1)) & (pos << 2 * (HEIGHT + 1));
-        rv |= p & (pos << 3 * (HEIGHT + 1));
-        rv |= p & (pos >> (HEIGHT + 1));
-        p = (pos >> (HEIGHT + 1)) & (pos >> 2 * (HEIGHT + 1));
-        rv |= p & (pos << (HEIGHT + 1));
-        rv |= p & (pos >> 3 * (HEIGHT + 1));
-
-        // Diagonal (\).
-        p = (pos << HEIGHT) & (pos << 2 * HEIGHT);
-        rv |= p & (pos << 3 * HEIGHT);
-        rv |= p & (pos >> HEIGHT);
-        p = (pos >> HEIGHT) & (pos >> 2 * HEIGHT);
-        rv |= p & (pos << HEIGHT);
-        rv |= p & (pos >> 3 * HEIGHT);
-
-        // Diagonal (/).
-        p = (pos << (HEIGHT + 2)) & (pos << 2 * (HEIGHT + 2));
-        rv |= p & (pos << 3 * (HEIGHT + 2));
-        rv |= p & (pos >> (HEIGHT + 2));
-        p = (pos >> (HEIGHT + 2)) & (pos >> 2 * (HEIGHT + 2));
-        rv |= p & (pos << (HEIGHT + 2));
-        rv |= p & (pos >> 3 * (HEIGHT + 2));
-
-        return rv & (boardMask ^ mask);
-    }
-
-    int countWinOpportunities(uint64_t move) const {
-        return popcount(winMask(position_ | move, mask_));
-    }
-
-    int getMoves() const {
-        return moves_;
-    }
-
-    Status getStatus() const {
-        return status_;
-    }
-
-    uint64_t key() const {
-        return position_ + mask_;
-    }
-
-    uint64_t symmetricKey() const {
-        uint64_t key = this->key();
-        uint64_t rv = 0;
-        for (int col = 0; col < WIDTH; ++col) {
-            int shift = (WIDTH - 2 * col - 1) * (HEIGHT + 1);
-            uint64_t full_column_mask =
-                ((UINT64_C(1) << (HEIGHT + 1)) - 1) << col * (HEIGHT + 1);
-            if (shift >= 0)
-                rv |= (key & full_column_mask) << shift;
-            else
-                rv |= (key & full_column_mask) >> -shift;
-        }
-        return rv;
-    }
-
-    static constexpr uint64_t columnMask(int col) {
-        return ((UINT64_C(1) << HEIGHT) - 1) << col * (HEIGHT + 1);
-    }
-
-private:
-    // Positions are stored with two bitfields. The bits correspond to the
-    // following positions:
-    //     .   .   .   .   .   .   .
-    //     5  12  19  26  33  40  47
-    //     4  11  18  25  32  39  46
-    //     3  10  17  24  31  38  45
-    //     2   9  16  23  30  37  44
-    //     1   8  15  22  29  36  43
-    //     0   7  14  21  28  35  42
-    // mask is 1 for non-empty cells:
-    uint64_t mask_;
-    // position is 1 if a non-empty cell is for the current player:
-    uint64_t position_;
-
-    int moves_;
-    Status status_;
-
-    static constexpr uint64_t topMask(int col) {
-        return (UINT64_C(1) << (HEIGHT - 1)) << col * (HEIGHT + 1);
-    }
-
-    static constexpr uint64_t bottomMask(int col) {
-        return UINT64_C(1) << col * (HEIGHT + 1);
-    }
-
-    static constexpr uint64_t pointMask(int col, int row) {
-        return UINT64_C(1) << row << (col * (HEIGHT + 1));
-    }
-
-    static int popcount(uint64_t bitmask) {
-        int c;
-        for (c = 0; bitmask; c++)
-            bitmask &= bitmask - 1;
-        return c;
-    }
-
-    // Static constant bitmaps.
-    static const uint64_t floorMask = _floorMask(WIDTH, HEIGHT);
-    static const uint64_t boardMask = floorMask * ((UINT64_C(1) << HEIGHT) - 1);
-};
-
-
-class TranspositionTable {
-public:
-    TranspositionTable(size_t size) : data_(size) {
-        if (size <= 0)
-            throw std::runtime_error("size <= 0");
-        reset();
-    }
-
-    void put(uint64_t key, int8_t value) {
-        data_[index(key)] = {key, value};
-    }
-
-    std::pair<bool, int8_t> get(uint64_t key) const {
-        Entry entry = data_[index(key)];
-        if (entry.key != key || entry.value == 127)
-            return std::make_pair(false, 0);
-        return std::make_pair(true, entry.value);
-    }
-
-    void reset() {
-        memset(&data_[0], 127, data_.size() * sizeof(Entry));
-    }
-
-    size_t size() const {
-        return data_.size();
-    }
-
-private:
-    struct Entry {
-        uint64_t key: 56;
-        int8_t value;
-    };
-
-    std::vector<Entry> data_;
-
-    unsigned int index(uint64_t key) const {
-        if (key >> 56 != 0)
-            throw std::runtime_error("key >= 2 ** 56");
-        return key % data_.size();
+    static handle cast(uint128_t src, return_value_policy, handle) {
+        object high = reinterpret_steal<object>(PyLong_FromUnsignedLongLong(
+            static_cast<uint64_t>(src >> 64)));
+        object low = reinterpret_steal<object>(PyLong_FromUnsignedLongLong(
+            static_cast<uint64_t>(src)));
+        object shifted = reinterpret_steal<object>(
+            PyNumber_Lshift(high.ptr(), int_(64).ptr()));
+        return PyNumber_Or(shifted.ptr(), low.ptr());
     }
 };
+}  // namespace detail
+}  // namespace pybind11
+#endif
+
+
+// Solver constructor, taking an opening book for the standard board only.
+template <class Solver>
+void defineSolverInit(py::class_<Solver>& cls, const OpeningBook*) {
+    cls.def(py::init<int, size_t, std::shared_ptr<OpeningBook>,
+                     std::string>(),
+        py::arg("threads") = 1, py::arg("tt_mib") = 64,
+        py::arg("book") = nullptr, py::arg("shared_tt") = "");
+}
 
+template <class Solver, class Book>
+void defineSolverInit(py::class_<Solver>& cls, const Book*) {
+    cls.def(py::init([](int threads, size_t tt_mib,
+                        const std::string& shared_tt) {
+            return new Solver(threads, tt_mib, nullptr, shared_tt); }),
+        py::arg("threads") = 1, py::arg("tt_mib") = 64,
+        py::arg("shared_tt") = "");
+}
 
-class Solver {
-public:
-    Solver() : num_explored_pos_(0),
-               // Use a table size of 64 MiB.
-               // In practice using a close prime number for the size as this
-               // decreases the hit ratio.
-               max_score_table_(8388593) {
-        // Explore columns from the middle first.
-        for (int i = 0; i < Board::WIDTH; ++i)
-            column_order_[i] = Board::WIDTH / 2
-                + (1 - 2 * (i % 2)) * (i + 1) / 2;
-    }
-
-    int negamax(const Board& B) {
-        int max_score = Board::WIDTH * Board::HEIGHT / 2;
-        return negamax(B, -max_score, max_score);
-    }
-
-    int negamax(const Board& B, int alpha, int beta) {
-        num_explored_pos_++;
-
-        // Check board status.
-        if (B.getStatus() == Board::Draw) {
-            return 0;
-        } else if (B.getStatus() == Board::Player1Wins
-                || B.getStatus() == Board::Player2Wins) {
-            return (B.getMoves() - Board::WIDTH * Board::HEIGHT) / 2 - 1;
-        }
-
-        // Shortcut if direct win.
-        int max_score = (1 + Board::WIDTH * Board::HEIGHT - B.getMoves()) / 2;
-        for (int col = 0; col < Board::WIDTH; ++col) {
-            if (B.canPlay(col) && B.isWinningMove(col)) {
-                return max_score;
-            }
-        }
-        // Cannot win directly, max score decreases.
-        max_score--;
-
-        uint64_t next = B.candidatesMask();
-        if (next == 0) {
-            // No possible other move without losing. Opponent wins next move.
-            return -(Board::WIDTH * Board::HEIGHT - B.getMoves()) / 2;
-        }
-
-        // Possibly reduce further max_score using the transposition table.
-        std::pair<bool, int8_t> found = max_score_table_.get(B.key());
-        if (found.first)
-            max_score = found.second;
-
-        // Prune beta with max score.
-        if (max_score < beta) {
-            beta = max_score;
-            if (alpha >= beta) {
-                // Empty alpha-beta range.
-                return beta;
-            }
-        }
-
-        // Optimize column exploration.
-        std::vector<MoveAndNumOpportunities> sorted_moves;
-        for (int i = 0; i < Board::WIDTH; ++i) {
-            uint64_t move = next & Board::columnMask(column_order_[i]);
-            if (move) {
-                sorted_moves.emplace_back(MoveAndNumOpportunities(
-                    column_order_[i], B.countWinOpportunities(move)));
-            }
-        }
-        // reverse sort:
-        std::stable_sort(sorted_moves.rbegin(), sorted_moves.rend());
-
-        // Recursive exploration.
-        for (auto it = sorted_moves.begin(); it != sorted_moves.end(); it++) {
-            Board B2(B);
-            B2.play(it->move, false);
-            int score = -negamax(B2, -beta, -alpha);
-            if (score >= beta) {
-                // Outside research range (can happen for weak solver).
-                return beta;
-            } else if (score > alpha) {
-                // Prune alpha (keeps track of best score).
-                alpha = score;
-            }
-        }
-
-        // alpha: best score obtained.
-        max_score_table_.put(B.key(), alpha);
-        return alpha;
-    }
-
-    int dichotomicSolve(const Board& B, bool use_weak_solver = false) {
-        // Check board status.
-        if (B.getStatus() == Board::Draw) {
-            return 0;
-        } else if (B.getStatus() == Board::Player1Wins
-                || B.getStatus() == Board::Player2Wins) {
-            return (B.getMoves() - Board::WIDTH * Board::HEIGHT) / 2 - 1;
-        }
-
-        int min_score, max_score;
-        if (use_weak_solver) {
-            min_score = -1;
-            max_score = 1;
-        } else {
-            min_score = -(Board::WIDTH * Board::HEIGHT - B.getMoves()) / 2;
-            max_score = (1 + Board::WIDTH * Board::HEIGHT - B.getMoves()) / 2;
-        }
-
-        while (min_score < max_score) {
-            int med_score = min_score + (max_score - min_score) / 2;
-            if (med_score <= 0 && med_score > min_score / 2)
-                med_score = min_score / 2;
-            else if (med_score >= 0 && med_score < max_score / 2)
-                med_score = max_score / 2;
-
-            // Only search if the actual score is greater or smaller.
-            int null_window_score = negamax(B, med_score, med_score + 1);
-            if (null_window_score <= med_score)
-                max_score = med_score;
-            else
-                min_score = med_score + 1;
-        }
-        return min_score;
-    }
-
-    uint64_t getNumExploredPos() const {
-        return num_explored_pos_;
-    }
-
-    void reset() {
-        num_explored_pos_ = 0;
-        max_score_table_.reset();
-    }
-
-private:
-    uint64_t num_explored_pos_;
-    int column_order_[Board::WIDTH];
-    TranspositionTable max_score_table_;
-
-    struct MoveAndNumOpportunities {
-        int move;
-        int num_opportunities;
-
-        MoveAndNumOpportunities(int move, int num_opportunities) :
-            move(move), num_opportunities(num_opportunities) {}
-        bool operator<(const MoveAndNumOpportunities& other) const {
-            return num_opportunities < other.num_opportunities;
-        }
-    };
-};
-
-
-class OpeningBook {
-public:
-    OpeningBook(size_t depth) : depth_(depth) {
-        std::cout << "Will now generate opening book for depth "
-            << depth << "." << std::endl;
-        std::cout << "This will take some time..." << std::endl;
-        generate(Board());
-    }
-
-    OpeningBook(std::string filename) {
-        // Check file size.
-        struct stat stat_buf;
-        int rc = stat(filename.c_str(), &stat_buf);
-        if (rc != 0)
-            throw std::runtime_error("Cannot get size of " + filename);
-        size_t file_size = stat_buf.st_size;
-        if (file_size % 9 != 1)
-            throw std::runtime_error("Unexpected size for " + filename);
-
-        std::ifstream file(filename, std::ios::binary);
-
-        // Read opening book depth.
-        int8_t depth_as_int8;
-        file.read(reinterpret_cast<char *>(&depth_as_int8),
-                  sizeof(depth_as_int8));
-        depth_ = depth_as_int8;
-
-        // Read opening book key -> score pairs.
-        uint64_t key;
-        int8_t score;
-        for (size_t i = 0; i < (file_size - 1) / 9; ++i) {
-            file.read(reinterpret_cast<char *>(&key), sizeof(key));
-            file.read(reinterpret_cast<char *>(&score), sizeof(score));
-            book_[key] = score;
-        }
-
-        file.close();
-    }
-
-    void dump(std::string filename) const {
-        std::ofstream file(filename, std::ios::binary);
-
-        // Header.
-        int8_t depth_as_int8 = depth_;
-        file.write(reinterpret_cast<const char *>(&depth_as_int8),
-                   sizeof(depth_as_int8));
-
-        // Key-score pairs (sorted by keys).
-        std::set<uint64_t> sorted_keys;
-        for (const auto& kv : book_)
-            sorted_keys.emplace(kv.first);
-        for (uint64_t key : sorted_keys) {
-            int8_t score = book_.at(key);
-            file.write(reinterpret_cast<const char *>(&key), sizeof(key));
-            file.write(reinterpret_cast<const char *>(&score), sizeof(score));
-        }
-        file.close();
-    }
 
-    std::pair<bool, int8_t> get(const Board& B) {
-        if ((unsigned)B.getMoves() > depth_) {
-            // We know we do not have this key.
-            return std::make_pair(false, 0);
-        }
-        auto found = book_.find(B.key());
-        if (found == book_.end()) {
-            // Not found, try symmetric key.
-            found = book_.find(B.symmetricKey());
-        }
-        if (found == book_.end())
-            return std::make_pair(false, 0);
+// Scores of Solver::analyze(), with None for the columns that cannot be
+// played.
+py::list analysisToList(const std::vector<int>& scores, int invalid_score) {
+    py::list rv;
+    for (int score : scores) {
+        if (score == invalid_score)
+            rv.append(py::none());
         else
-            return std::make_pair(true, found->second);
+            rv.append(score);
     }
+    return rv;
+}
 
-    size_t getDepth() const {
-        return depth_;
-    }
 
-private:
-    size_t depth_;
-    std::unordered_map<uint64_t, int8_t> book_;
+// Array of the n values at data, owned by base.
+template <class T>
+py::array_t<T> readOnlyView(const T* data, size_t n, py::object base) {
+    py::array_t<T> rv(n, data, base);
+    rv.attr("setflags")(py::arg("write") = false);
+    return rv;
+}
 
-    Solver solver_;
 
-    int8_t generate(const Board& B) {
-        // Return now if already computed (considering symmetric Board).
-        auto found = book_.find(B.key());
-        if (found != book_.end())
-            return found->second;
-        found = book_.find(B.symmetricKey());
-        if (found != book_.end())
-            return found->second;
+// Solver statistics, the search counters being only available when compiled
+// with CONNECTLIB_STATS.
+template <class Solver>
+py::dict statsToDict(const Solver& solver) {
+    typename Solver::Stats stats = solver.getStats();
+    py::dict rv;
+    rv["nodes"] = solver.getNumExploredPos();
+    rv["iterations"] = stats.iterations;
+    py::list iteration_seconds;
+    for (double seconds : stats.iteration_seconds)
+        iteration_seconds.append(seconds);
+    rv["iteration_seconds"] = iteration_seconds;
+#ifdef CONNECTLIB_STATS
+    rv["tt_probes"] = stats.table.probes;
+    rv["tt_hits"] = stats.table.hits;
+    rv["tt_collisions"] = stats.table.collisions;
+    rv["tt_overwrites"] = stats.table.overwrites;
+    py::list nodes_per_depth, cutoffs_per_depth;
+    uint64_t cutoffs = 0;
+    for (int i = 0; i <= Solver::Board::WIDTH * Solver::Board::HEIGHT; ++i) {
+        nodes_per_depth.append(stats.nodes[i]);
+        cutoffs_per_depth.append(stats.cutoffs[i]);
+        cutoffs += stats.cutoffs[i];
+    }
+    rv["nodes_per_depth"] = nodes_per_depth;
+    rv["cutoffs_per_depth"] = cutoffs_per_depth;
+    rv["first_move_cutoff_rate"] =
+        cutoffs == 0 ? 0.0 : double(stats.first_move_cutoffs) / cutoffs;
+#endif
+    return rv;
+}
 
-        int8_t score;
-        if (B.getStatus() != Board::Status::InProgress) {
-	        // Handle finished game.
-	        score = solver_.negamax(B);
-	    } else if ((unsigned)B.getMoves() < depth_) {
-            // Compute score on deeper depths first. The current score is then
-            // trivially computed with one negamax step.
-            score = -Board::WIDTH * Board::HEIGHT - 2; // lower bound
-            for (int col = 0; col < Board::WIDTH; ++col) {
-                if (B.canPlay(col)) {
-                    Board B2(B);
-                    B2.play(col);
-                    int8_t play_score = -generate(B2);
-                    if (score < play_score)
-                        score = play_score;
-                }
-            }
-        } else {
-            // Maximum depth. Compute score with the Solver instance.
-            score = solver_.dichotomicSolve(B);
-        }
 
-        book_[B.key()] = score;
-        std::cout << "moves=" << B.getMoves()
-                  << ", key=" << B.key()
-                  << ", score=" << (int) score << std::endl;
-        return score;
-    }
-};
+// Registers BoardWxH, SolverWxH and PNSolverWxH.
+template <int W, int H>
+void defineGeometry(py::module_& m) {
+    typedef BasicBoard<W, H> Board;
+    typedef BasicSolver<W, H> Solver;
+    typedef BasicPNSolver<W, H> PNSolver;
+    std::string suffix = std::to_string(W) + "x" + std::to_string(H);
 
-
-PYBIND11_MODULE(connectlib, m) {
-    py::class_<Board>(m, "Board")
+    py::class_<Board>(m, ("Board" + suffix).c_str())
         .def(py::init<>())
         .def(py::init<std::string>())
-        .def(py::init<uint64_t>())
+        .def(py::init<typename Board::Key>())
         .def("__repr__", [](const Board& b) { return b.toString(); })
         .def("key", &Board::key)
         .def("symmetricKey", &Board::symmetricKey)
@@ -644,35 +147,263 @@ PYBIND11_MODULE(connectlib, m) {
         .def_property_readonly_static("HEIGHT",
             [](py::object) { return Board::HEIGHT; });
 
-    py::enum_<Board::Status>(m, "GameStatus")
-        .value("InProgress", Board::Status::InProgress)
-        .value("Draw", Board::Status::Draw)
-        .value("Player1Wins", Board::Status::Player1Wins)
-        .value("Player2Wins", Board::Status::Player2Wins)
-        .export_values();
-
-    py::class_<Solver>(m, "Solver")
-        .def(py::init<>())
+    py::class_<Solver> solver(m, ("Solver" + suffix).c_str());
+    defineSolverInit(solver,
+                     static_cast<const typename Solver::Book*>(nullptr));
+    solver
         .def("negamax", [](Solver& s, const Board& b) {
-            return s.negamax(b); })
+            return s.negamax(b); },
+            py::call_guard<py::gil_scoped_release>())
         .def("negamax", [](Solver& s, const Board& b, int alpha, int beta) {
             return s.negamax(b, alpha, beta); })
         .def("dichotomicSolve", &Solver::dichotomicSolve,
-            py::arg("board"), py::arg("use_weak_solver") = false)
+            py::arg("board"), py::arg("use_weak_solver") = false,
+            py::call_guard<py::gil_scoped_release>())
+        .def("solve", [](Solver& s, const Board& b, double deadline_ms,
+                         uint64_t max_nodes, bool use_weak_solver) {
+                typename Solver::SolveResult result;
+                {
+                    py::gil_scoped_release release;
+                    result = s.solve(b, deadline_ms, max_nodes,
+                                     use_weak_solver);
+                }
+                py::object best_move = py::none();
+                if (result.best_move >= 0)
+                    best_move = py::int_(result.best_move + 1);
+                return py::make_tuple(result.min_score, result.max_score,
+                                      best_move);
+            },
+            py::arg("board"), py::arg("deadline_ms") = 0,
+            py::arg("max_nodes") = 0, py::arg("use_weak_solver") = false)
+        .def("cancel", &Solver::cancel, py::arg("search_id") = 0)
+        .def_property_readonly("next_search_id", &Solver::nextSearchId)
+        .def("analyze", [](Solver& s, const Board& b, bool best_only) {
+                std::vector<int> scores;
+                {
+                    py::gil_scoped_release release;
+                    scores = s.analyze(b, best_only);
+                }
+                return analysisToList(scores, Solver::INVALID_SCORE);
+            },
+            py::arg("board"), py::arg("best_only") = false)
         .def_property_readonly("num_explored_pos", &Solver::getNumExploredPos)
-        .def("reset", &Solver::reset);
+        .def_property_readonly("threads", &Solver::getNumThreads)
+        .def_property("symmetric", &Solver::isSymmetric, &Solver::setSymmetric)
+        .def_property_readonly("stats", &statsToDict<Solver>)
+        .def("reset", &Solver::reset)
+        .def("save_table", &Solver::saveTable, py::arg("filename"),
+            py::call_guard<py::gil_scoped_release>())
+        .def("load_table", &Solver::loadTable, py::arg("filename"));
+
+    py::class_<PNSolver>(m, ("PNSolver" + suffix).c_str())
+        .def(py::init<size_t>(), py::arg("tt_mib") = 64)
+        .def("solve", [](PNSolver& s, const Board& b, uint64_t max_nodes) {
+                int score;
+                {
+                    py::gil_scoped_release release;
+                    score = s.solve(b, max_nodes);
+                }
+                if (score == PNSolver::INVALID_SCORE)
+                    return py::object(py::none());
+                return py::object(py::int_(score));
+            },
+            py::arg("board"), py::arg("max_nodes") = 0)
+        .def_property_readonly("num_explored_pos",
+                               &PNSolver::getNumExploredPos)
+        .def("reset", &PNSolver::reset);
+}
+
+
+PYBIND11_MODULE(connectlib, m) {
+    py::enum_<GameStatus>(m, "GameStatus")
+        .value("InProgress", GameStatus::InProgress)
+        .value("Draw", GameStatus::Draw)
+        .value("Player1Wins", GameStatus::Player1Wins)
+        .value("Player2Wins", GameStatus::Player2Wins)
+        .export_values();
+
+    defineGeometry<Board::WIDTH, Board::HEIGHT>(m);
+    defineGeometry<Board6x5::WIDTH, Board6x5::HEIGHT>(m);
+    defineGeometry<Board8x7::WIDTH, Board8x7::HEIGHT>(m);
+#ifdef CONNECTLIB_HAS_UINT128
+    defineGeometry<Board9x7::WIDTH, Board9x7::HEIGHT>(m);
+#endif
+    // The standard board.
+    m.attr("Board") = m.attr("Board7x6");
+    m.attr("Solver") = m.attr("Solver7x6");
+    m.attr("PNSolver") = m.attr("PNSolver7x6");
+
+    m.def("solve_many", [](py::object keys_or_sequences,
+                           bool use_weak_solver, int threads,
+                           size_t tt_mib, std::shared_ptr<OpeningBook> book) {
+            // Boards are decoded with the GIL held, then solved without it.
+            std::vector<Board> boards;
+            if (py::isinstance<py::array>(keys_or_sequences)) {
+                auto keys = py::array_t<uint64_t, py::array::c_style
+                                                  | py::array::forcecast>
+                    ::ensure(keys_or_sequences);
+                if (!keys || keys.ndim() != 1)
+                    throw std::runtime_error("Expected a 1D array of keys.");
+                boards.reserve(keys.size());
+                for (py::ssize_t i = 0; i < keys.size(); ++i)
+                    boards.emplace_back(keys.data()[i]);
+            } else {
+                for (py::handle item : py::iterable(keys_or_sequences)) {
+                    if (py::isinstance<py::str>(item))
+                        boards.emplace_back(item.cast<std::string>());
+                    else
+                        boards.emplace_back(item.cast<uint64_t>());
+                }
+            }
+            std::vector<int8_t> scores;
+            {
+                py::gil_scoped_release release;
+                scores = solveMany(boards, use_weak_solver, threads, tt_mib,
+                                   book);
+            }
+            return py::array_t<int8_t>(scores.size(), scores.data());
+        },
+        py::arg("keys_or_sequences"), py::arg("weak") = false,
+        py::arg("threads") = 0, py::arg("tt_mib") = 64,
+        py::arg("book") = nullptr);
+
+    m.def("export_positions", [](const std::string& filename, int depth,
+                                 int threads, size_t tt_mib,
+                                 std::shared_ptr<OpeningBook> book) {
+            return exportPositions(filename, depth, threads, tt_mib, book);
+        },
+        py::arg("filename"), py::arg("depth"), py::arg("threads") = 0,
+        py::arg("tt_mib") = 64, py::arg("book") = nullptr,
+        py::call_guard<py::gil_scoped_release>());
+
+    // Arrays out of a batch are computed in one pass over its columns, or
+    // are read-only views of them, kept valid by a reference to the batch.
+    py::class_<BoardBatch>(m, "BoardBatch")
+        .def(py::init<size_t>(), py::arg("size"))
+        .def(py::init([](py::array_t<uint64_t, py::array::c_style
+                                               | py::array::forcecast> keys) {
+                if (keys.ndim() != 1)
+                    throw std::runtime_error("Expected a 1D array of keys.");
+                return new BoardBatch(keys.data(), keys.size());
+            }),
+            py::arg("keys"))
+        .def("__len__", &BoardBatch::size)
+        .def("__getitem__", [](const BoardBatch& b, size_t i) {
+                if (i >= b.size())
+                    throw py::index_error();
+                return b.get(i);
+            })
+        .def("__setitem__", [](BoardBatch& b, size_t i, const Board& B) {
+                if (i >= b.size())
+                    throw py::index_error();
+                b.set(i, B);
+            })
+        .def("play", [](BoardBatch& b,
+                        py::array_t<int, py::array::c_style
+                                         | py::array::forcecast> cols) {
+                if (cols.ndim() != 1
+                        || static_cast<size_t>(cols.size()) != b.size())
+                    throw std::runtime_error(
+                        "Expected a 1D array of one column per board.");
+                // Columns are numbered from 1, 0 leaving the board unchanged.
+                std::vector<int> zero_based(b.size());
+                for (size_t i = 0; i < b.size(); ++i) {
+                    if (cols.data()[i] < 0)
+                        throw std::runtime_error("Invalid column.");
+                    zero_based[i] = cols.data()[i] - 1;
+                }
+                py::gil_scoped_release release;
+                b.play(zero_based.data());
+            },
+            py::arg("cols"))
+        .def("canPlay", [](const BoardBatch& b, int col) {
+                py::array_t<bool> rv(b.size());
+                b.canPlay(col - 1, rv.mutable_data());
+                return rv;
+            })
+        .def("key", [](const BoardBatch& b) {
+                py::array_t<uint64_t> rv(b.size());
+                b.keys(rv.mutable_data());
+                return rv;
+            })
+        .def("symmetricKey", [](const BoardBatch& b) {
+                py::array_t<uint64_t> rv(b.size());
+                b.symmetricKeys(rv.mutable_data());
+                return rv;
+            })
+        .def("winMask", [](const BoardBatch& b) {
+                py::array_t<uint64_t> rv(b.size());
+                b.winMasks(rv.mutable_data());
+                return rv;
+            })
+        .def_property_readonly("mask", [](py::object self) {
+                const BoardBatch& b = self.cast<const BoardBatch&>();
+                return readOnlyView(b.masks(), b.size(), self);
+            })
+        .def_property_readonly("position", [](py::object self) {
+                const BoardBatch& b = self.cast<const BoardBatch&>();
+                return readOnlyView(b.positions(), b.size(), self);
+            })
+        .def_property_readonly("moves", [](py::object self) {
+                const BoardBatch& b = self.cast<const BoardBatch&>();
+                return readOnlyView(b.moves(), b.size(), self);
+            })
+        .def_property_readonly("status", [](py::object self) {
+                const BoardBatch& b = self.cast<const BoardBatch&>();
+                return readOnlyView(b.statuses(), b.size(), self);
+            });
 
     py::class_<TranspositionTable>(m, "TranspositionTable")
-        .def(py::init<size_t>())
+        .def(py::init<size_t, std::string>(),
+            py::arg("size"), py::arg("shared") = "")
         .def("__len__", &TranspositionTable::size)
         .def("__getitem__", &TranspositionTable::get)
-        .def("__setitem__", &TranspositionTable::put)
-        .def("reset", &TranspositionTable::reset);
-
-    py::class_<OpeningBook>(m, "OpeningBook")
-        .def(py::init<size_t>())
-        .def(py::init<std::string>())
+        .def("__setitem__", [](TranspositionTable& t, uint64_t key,
+                               int8_t value) { t.put(key, value); })
+        .def("put", [](TranspositionTable& t, uint64_t key, int8_t value,
+                       int moves) {
+                t.put(key, value, TranspositionTable::NO_LOWER_BOUND, moves);
+            },
+            py::arg("key"), py::arg("value"), py::arg("moves") = 0)
+        .def("reset", &TranspositionTable::reset)
+        .def("save", &TranspositionTable::save, py::arg("filename"))
+        .def("load", &TranspositionTable::load, py::arg("filename"))
+        .def_static("unlink_shared", &TranspositionTable::unlinkShared,
+            py::arg("name"));
+
+    py::class_<Ponderer>(m, "Ponderer")
+        .def(py::init<int, size_t, std::shared_ptr<OpeningBook>>(),
+            py::arg("threads") = 1, py::arg("tt_mib") = 64,
+            py::arg("book") = nullptr)
+        .def("analyze", [](Ponderer& p, const Board& b) {
+                std::vector<int> scores;
+                {
+                    py::gil_scoped_release release;
+                    scores = p.analyze(b);
+                }
+                return analysisToList(scores, Solver::INVALID_SCORE);
+            },
+            py::arg("board"))
+        .def("ponder", &Ponderer::ponder, py::arg("board"))
+        .def("__contains__", &Ponderer::isCached)
+        .def("__len__", &Ponderer::cacheSize)
+        .def_property_readonly("num_cancelled", &Ponderer::getNumCancelled);
+
+    py::class_<OpeningBook, std::shared_ptr<OpeningBook>>(m, "OpeningBook")
+        .def(py::init<size_t, int, std::string>(),
+            py::arg("depth"), py::arg("threads") = 0,
+            py::arg("checkpoint") = "",
+            py::call_guard<py::gil_scoped_release>())
+        .def(py::init<std::string>(),
+            py::call_guard<py::gil_scoped_release>())
         .def_property_readonly("depth", &OpeningBook::getDepth)
+        .def_property_readonly("weak", &OpeningBook::isWeak)
         .def("__getitem__", &OpeningBook::get)
-        .def("dump", &OpeningBook::dump);
+        .def("__len__", &OpeningBook::size)
+        .def("dump", &OpeningBook::dump,
+            py::arg("filename"), py::arg("mapped") = false)
+        .def("dump_compact", &OpeningBook::dumpCompact,
+            py::arg("filename"), py::arg("weak") = false)
+        .def_static("convert", &OpeningBook::convert,
+            py::arg("filename"), py::arg("mapped_filename"));
 }
@@ -0,0 +1,3192 @@
+// Connect 4 boards and solvers, independent of Python (see connectlib.cpp for
+// the Python module).
+#ifndef CONNECTPY_CONNECTLIB_H
+#define CONNECTPY_CONNECTLIB_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+// Books compressed with gzip can only be loaded when compiled with
+// -DCONNECTLIB_ZLIB (and linked with -lz).
+#ifdef CONNECTLIB_ZLIB
+#include <zlib.h>
+#endif
+
+// The hot search functions are compiled for several instruction sets and the
+// best one for the CPU is selected when the module is loaded, so that a
+// generic build still uses POPCNT, BMI and AVX2 instructions when available.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11 \
+    && defined(__x86_64__) && defined(__ELF__)
+#define CONNECTLIB_MULTIVERSION \
+    __attribute__((target_clones("arch=x86-64-v3", "popcnt", "default")))
+#else
+#define CONNECTLIB_MULTIVERSION
+#endif
+
+// Counters of the search (see BasicSolver::Stats), which slow it down, are
+// only compiled in with -DCONNECTLIB_STATS.
+#ifdef CONNECTLIB_STATS
+#define CONNECTLIB_STAT(...) __VA_ARGS__
+#else
+#define CONNECTLIB_STAT(...)
+#endif
+
+
+// Boards of more than 64 cells (counting the extra row above each column)
+// need 128-bit words, which are only available with GCC and Clang.
+#if defined(__SIZEOF_INT128__)
+#define CONNECTLIB_HAS_UINT128
+typedef unsigned __int128 uint128_t;
+#endif
+
+// Smallest unsigned word holding a board of the given size.
+template <int WIDTH, int HEIGHT, bool FITS_64 = WIDTH * (HEIGHT + 1) <= 64>
+struct BoardWord {
+    typedef uint64_t type;
+};
+
+#ifdef CONNECTLIB_HAS_UINT128
+template <int WIDTH, int HEIGHT>
+struct BoardWord<WIDTH, HEIGHT, false> {
+    typedef uint128_t type;
+};
+#endif
+
+
+// Must be defined outside of the class to be known at compile time.
+template <class Word>
+constexpr Word _floorMask(int width, int height) {
+    return width == 0 ? 0
+        : _floorMask<Word>(width - 1, height)
+            | (static_cast<Word>(1) << (width - 1) * (height + 1));
+}
+
+// Shared by all the board geometries.
+enum GameStatus {
+    InProgress,
+    Draw,
+    Player1Wins,
+    Player2Wins,
+};
+
+template <int W, int H, class Word = typename BoardWord<W, H>::type>
+class BasicBoardBatch;
+
+template <int W, int H, class Word = typename BoardWord<W, H>::type>
+class BasicBoard {
+public:
+    static const int WIDTH = W;
+    static const int HEIGHT = H;
+    static_assert(WIDTH < 10, "");
+    static_assert(WIDTH * (HEIGHT + 1) <= 8 * sizeof(Word), "");
+
+    typedef Word Key;
+    typedef GameStatus Status;
+
+    BasicBoard() : mask_(0), position_(0), moves_(0),
+                   status_(Status::InProgress) {}
+
+    BasicBoard(std::string sequence) : BasicBoard() {
+        play(sequence);
+    }
+
+    BasicBoard(Word key) {
+        // In each column, the highest bit of key + floorMask is just above
+        // the stones, and the bits below are the stones of the current
+        // player.
+        Word full = key + floorMask;
+        // Smear the bits downwards within each column (the bits shifted
+        // into the top rows come from the next column and are dropped).
+        Word smeared = full;
+        for (int shift = 1; shift <= HEIGHT; shift *= 2)
+            smeared |= (smeared >> shift) & ~topRowsMask(shift);
+        mask_ = (smeared >> 1) & boardMask;
+        position_ = full & mask_;
+        moves_ = popcount(mask_);
+        if (hasAlignment(position_ ^ mask_)) {
+            status_ = (moves_ % 2) == 1 ? Status::Player1Wins : Status::Player2Wins;
+        } else if (moves_ == HEIGHT * WIDTH) {
+            status_ = Status::Draw;
+        } else {
+            status_ = Status::InProgress;
+        }
+    }
+
+    std::string toString() const {
+        static const std::string large_red_circle = "\xF0\x9F\x94\xB4";
+        static const std::string large_yellow_circle = "\xF0\x9F\x9F\xA1";
+        static const std::string white_square_button = "\xF0\x9F\x94\xB3";
+        std::ostringstream os;
+        for (int i = HEIGHT - 1; i >= 0; --i) {
+            for (int j = 0; j < WIDTH; ++j) {
+                Word bitmask = static_cast<Word>(1) << i << j * (HEIGHT + 1);
+                if ((mask_ & bitmask) == 0) {
+                    os << white_square_button;
+                } else if (((position_ & bitmask) == 0) ^ ((moves_ % 2) == 0)) {
+                    os << large_red_circle;
+                } else {
+                    os << large_yellow_circle;
+                }
+            }
+            if (i == 1) {
+                os << "   " << moves_ << " moves";
+            } else if (i == 0 && status_ == Status::InProgress) {
+                os << "   "
+                   << (moves_ % 2 == 0 ? large_red_circle
+                                       : large_yellow_circle)
+                   << "'s turn";
+            } else if (i == 0 && status_ == Status::Draw) {
+                os << "   draw";
+            } else if (i == 0) {
+                os << "   winner: "
+                   << (status_ == Status::Player1Wins ? large_red_circle
+                                                      : large_yellow_circle);
+            }
+            if (i > 0)
+                os << "\n";
+        }
+        return os.str();
+    }
+
+    bool canPlay(int col) const {
+        return status_ == Status::InProgress && col >= 0 && col < WIDTH
+            && (mask_ & topMask(col)) == 0;
+    }
+
+    void assertCanPlay(int col) const {
+        if (canPlay(col))
+            return;
+        std::ostringstream os;
+        os << "Cannot play there (" << col << ").";
+        throw std::runtime_error(os.str());
+    }
+
+    void play(int col, bool check_alignment=true) {
+        position_ ^= mask_;
+        mask_ |= mask_ + bottomMask(col);
+
+        if (check_alignment && hasAlignment(position_ ^ mask_))
+            status_ = (moves_ % 2) == 0 ? Status::Player1Wins : Status::Player2Wins;
+
+        moves_++;
+
+        if (status_ == Status::InProgress && moves_ == HEIGHT * WIDTH)
+            status_ = Status::Draw;
+    }
+
+    void play(std::string sequence) {
+        for (unsigned int i = 0; i < sequence.size(); i++) {
+            int col = (int) (sequence[i] - '1'); // "1" -> 0, "2" -> 1, etc.
+            assertCanPlay(col);
+            play(col);
+        }
+    }
+
+    static bool hasAlignment(Word pos) {
+        // Horizontal.
+        Word m = pos & (pos << (HEIGHT + 1));
+        if (m & (m << (2 * (HEIGHT + 1))))
+            return true;
+        // Diagonal (\).
+        m = pos & (pos << HEIGHT);
+        if (m & (m << (2 * HEIGHT)))
+            return true;
+        // Diagonal (/).
+        m = pos & (pos << (HEIGHT + 2));
+        if (m & (m << (2 * (HEIGHT + 2))))
+            return true;
+        // Vertical.
+        m = pos & (pos << 1);
+        if (m & (m << 2))
+            return true;
+        // No alignment found.
+        return false;
+    }
+
+    bool isWinningMove(int col) const {
+        return hasAlignment(position_ | (
+            (mask_ + bottomMask(col)) & columnMask(col)));
+    }
+
+    Word candidatesMask() const {
+        // All places where the current player can play.
+        Word possible_moves = (mask_ + floorMask) & boardMask;
+
+        // We are forced to play where the opponent can win.
+        Word opponent_win_mask = opponentWinMask();
+        Word forced_mask = opponent_win_mask & possible_moves;
+        if (forced_mask) {
+            if (forced_mask & (forced_mask - 1)) {
+                // There are at least two forced moves. We cannot play anything.
+                return 0;
+            } else {
+                // We are forced to play to prevent the opponent from winning.
+                possible_moves = forced_mask;
+            }
+        }
+
+        // Do not play below opponent winning position.
+        possible_moves &= ~(opponent_win_mask >> 1);
+
+        return possible_moves;
+    }
+
+    Word opponentWinMask() const {
+        return winMask(position_ ^ mask_, mask_);
+    }
+
+    // Whether the current player can win with their next move.
+    bool canWinNext() const {
+        return (winMask() & (mask_ + floorMask) & boardMask) != 0;
+    }
+
+    Word winMask() const {
+        return winMask(position_, mask_);
+    }
+
+    static Word winMask(Word pos, Word mask) {
+        // Vertical.
+        Word rv = (pos << 1) & (pos << 2) & (pos << 3);
+
+        // Horizontal.
+        Word p = (pos << (HEIGHT + 1)) & (pos << 2 * (HEIGHT + 1));
+        rv |= p & (pos << 3 * (HEIGHT + 1));
+        rv |= p & (pos >> (HEIGHT + 1));
+        p = (pos >> (HEIGHT + 1)) & (pos >> 2 * (HEIGHT + 1));
+        rv |= p & (pos << (HEIGHT + 1));
+        rv |= p & (pos >> 3 * (HEIGHT + 1));
+
+        // Diagonal (\).
+        p = (pos << HEIGHT) & (pos << 2 * HEIGHT);
+        rv |= p & (pos << 3 * HEIGHT);
+        rv |= p & (pos >> HEIGHT);
+        p = (pos >> HEIGHT) & (pos >> 2 * HEIGHT);
+        rv |= p & (pos << HEIGHT);
+        rv |= p & (pos >> 3 * HEIGHT);
+
+        // Diagonal (/).
+        p = (pos << (HEIGHT + 2)) & (pos << 2 * (HEIGHT + 2));
+        rv |= p & (pos << 3 * (HEIGHT + 2));
+        rv |= p & (pos >> (HEIGHT + 2));
+        p = (pos >> (HEIGHT + 2)) & (pos >> 2 * (HEIGHT + 2));
+        rv |= p & (pos << (HEIGHT + 2));
+        rv |= p & (pos >> 3 * (HEIGHT + 2));
+
+        return rv & (boardMask ^ mask);
+    }
+
+    Word keyAfter(Word move) const {
+        // Key of the board after playing the move (a single bit, as given
+        // by candidatesMask()).
+        return (position_ ^ mask_) + (mask_ | move);
+    }
+
+    int countWinOpportunities(Word move) const {
+        return popcount(winMask(position_ | move, mask_));
+    }
+
+    int getMoves() const {
+        return moves_;
+    }
+
+    Status getStatus() const {
+        return status_;
+    }
+
+    Word key() const {
+        return position_ + mask_;
+    }
+
+    Word symmetricKey() const {
+        return mirrorKey(key());
+    }
+
+    // Key of the mirror image of the board of a key.
+    static Word mirrorKey(Word key) {
+        // Exchange columns col and WIDTH - 1 - col with one delta swap each.
+        for (int col = 0; col < WIDTH / 2; ++col) {
+            int delta = (WIDTH - 2 * col - 1) * (HEIGHT + 1);
+            Word full_column_mask = ((static_cast<Word>(1) << (HEIGHT + 1)) - 1)
+                << col * (HEIGHT + 1);
+            Word swapped = ((key >> delta) ^ key) & full_column_mask;
+            key ^= swapped | (swapped << delta);
+        }
+        return key;
+    }
+
+    // Same key for a board and its mirror image.
+    Word canonicalKey() const {
+        return std::min(key(), symmetricKey());
+    }
+
+    static constexpr Word columnMask(int col) {
+        return ((static_cast<Word>(1) << HEIGHT) - 1) << col * (HEIGHT + 1);
+    }
+
+private:
+    friend class BasicBoardBatch<W, H, Word>;
+
+    // Positions are stored with two bitfields. The bits correspond to the
+    // following positions (on the standard 7x6 board):
+    //     .   .   .   .   .   .   .
+    //     5  12  19  26  33  40  47
+    //     4  11  18  25  32  39  46
+    //     3  10  17  24  31  38  45
+    //     2   9  16  23  30  37  44
+    //     1   8  15  22  29  36  43
+    //     0   7  14  21  28  35  42
+    // mask is 1 for non-empty cells:
+    Word mask_;
+    // position is 1 if a non-empty cell is for the current player:
+    Word position_;
+
+    int moves_;
+    Status status_;
+
+    static constexpr Word topMask(int col) {
+        return (static_cast<Word>(1) << (HEIGHT - 1)) << col * (HEIGHT + 1);
+    }
+
+    static constexpr Word bottomMask(int col) {
+        return static_cast<Word>(1) << col * (HEIGHT + 1);
+    }
+
+    static int popcount(uint64_t bitmask) {
+#if defined(__GNUC__)
+        // A single instruction in the code compiled for CPUs with POPCNT
+        // (see CONNECTLIB_MULTIVERSION).
+        return __builtin_popcountll(bitmask);
+#else
+        bitmask -= (bitmask >> 1) & UINT64_C(0x5555555555555555);
+        bitmask = (bitmask & UINT64_C(0x3333333333333333))
+            + ((bitmask >> 2) & UINT64_C(0x3333333333333333));
+        bitmask = (bitmask + (bitmask >> 4)) & UINT64_C(0x0F0F0F0F0F0F0F0F);
+        return (bitmask * UINT64_C(0x0101010101010101)) >> 56;
+#endif
+    }
+
+#ifdef CONNECTLIB_HAS_UINT128
+    static int popcount(uint128_t bitmask) {
+        return popcount(static_cast<uint64_t>(bitmask))
+            + popcount(static_cast<uint64_t>(bitmask >> 64));
+    }
+#endif
+
+    // Rows HEIGHT + 1 - rows to HEIGHT of every column.
+    static constexpr Word topRowsMask(int rows) {
+        return _floorMask<Word>(WIDTH, HEIGHT)
+            * (((static_cast<Word>(1) << rows) - 1) << (HEIGHT + 1 - rows));
+    }
+
+    // Static constant bitmaps.
+    static constexpr Word floorMask = _floorMask<Word>(WIDTH, HEIGHT);
+    static constexpr Word boardMask =
+        floorMask * ((static_cast<Word>(1) << HEIGHT) - 1);
+};
+
+template <int W, int H, class Word>
+constexpr Word BasicBoard<W, H, Word>::floorMask;
+template <int W, int H, class Word>
+constexpr Word BasicBoard<W, H, Word>::boardMask;
+
+// The standard board and the variants exposed to Python.
+typedef BasicBoard<7, 6> Board;
+typedef BasicBoard<6, 5> Board6x5;
+typedef BasicBoard<8, 7> Board8x7;
+#ifdef CONNECTLIB_HAS_UINT128
+typedef BasicBoard<9, 7> Board9x7;
+#endif
+
+
+// Boards stored as one array per field (structure of arrays), to process many
+// of them at once. The loops over the boards are branch-free so that the
+// compiler vectorizes them, using AVX2 in the clones selected for the CPUs
+// which have it (see CONNECTLIB_MULTIVERSION).
+template <int W, int H, class Word>
+class BasicBoardBatch {
+public:
+    typedef BasicBoard<W, H, Word> Board;
+
+    // Empty boards.
+    explicit BasicBoardBatch(size_t size = 0)
+        : mask_(size, 0), position_(size, 0), moves_(size, 0),
+          status_(size, static_cast<int8_t>(GameStatus::InProgress)) {}
+
+    BasicBoardBatch(const Word* keys, size_t size) : BasicBoardBatch(size) {
+        for (size_t i = 0; i < size; ++i)
+            set(i, Board(keys[i]));
+    }
+
+    size_t size() const {
+        return mask_.size();
+    }
+
+    Board get(size_t i) const {
+        Board B;
+        B.mask_ = mask_[i];
+        B.position_ = position_[i];
+        B.moves_ = moves_[i];
+        B.status_ = static_cast<GameStatus>(status_[i]);
+        return B;
+    }
+
+    void set(size_t i, const Board& B) {
+        mask_[i] = B.mask_;
+        position_[i] = B.position_;
+        moves_[i] = static_cast<int8_t>(B.moves_);
+        status_[i] = static_cast<int8_t>(B.status_);
+    }
+
+    // Plays column cols[i] on board i, or nothing if cols[i] < 0. Throws,
+    // leaving the boards unchanged, if a column cannot be played.
+    void play(const int* cols) {
+        // Exceptions cannot go through the functions with clones.
+        if (!canPlayAll(cols)) {
+            for (size_t i = 0; i < size(); ++i) {
+                if (cols[i] >= 0 && !get(i).canPlay(cols[i])) {
+                    std::ostringstream os;
+                    os << "Cannot play there (" << cols[i] << ") on board "
+                       << i << ".";
+                    throw std::runtime_error(os.str());
+                }
+            }
+        }
+        playUnchecked(cols);
+    }
+
+    CONNECTLIB_MULTIVERSION
+    void canPlay(int col, bool* out) const {
+        const Word* mask = mask_.data();
+        const int8_t* status = status_.data();
+        if (col < 0 || col >= W) {
+            std::fill(out, out + size(), false);
+            return;
+        }
+        Word top = Board::topMask(col);
+        for (size_t i = 0, n = size(); i < n; ++i)
+            out[i] = (status[i] == GameStatus::InProgress)
+                & ((mask[i] & top) == 0);
+    }
+
+    CONNECTLIB_MULTIVERSION
+    void keys(Word* out) const {
+        const Word* mask = mask_.data();
+        const Word* position = position_.data();
+        for (size_t i = 0, n = size(); i < n; ++i)
+            out[i] = position[i] + mask[i];
+    }
+
+    CONNECTLIB_MULTIVERSION
+    void symmetricKeys(Word* out) const {
+        const Word* mask = mask_.data();
+        const Word* position = position_.data();
+        for (size_t i = 0, n = size(); i < n; ++i)
+            out[i] = Board::mirrorKey(position[i] + mask[i]);
+    }
+
+    // Cells where the current player of each board would win.
+    CONNECTLIB_MULTIVERSION
+    void winMasks(Word* out) const {
+        const Word* mask = mask_.data();
+        const Word* position = position_.data();
+        for (size_t i = 0, n = size(); i < n; ++i)
+            out[i] = Board::winMask(position[i], mask[i]);
+    }
+
+    const Word* masks() const {
+        return mask_.data();
+    }
+
+    const Word* positions() const {
+        return position_.data();
+    }
+
+    const int8_t* moves() const {
+        return moves_.data();
+    }
+
+    // As GameStatus values.
+    const int8_t* statuses() const {
+        return status_.data();
+    }
+
+private:
+    std::vector<Word> mask_;
+    std::vector<Word> position_;
+    std::vector<int8_t> moves_;
+    std::vector<int8_t> status_;
+
+    CONNECTLIB_MULTIVERSION
+    bool canPlayAll(const int* cols) const {
+        const Word* mask = mask_.data();
+        const int8_t* status = status_.data();
+        Word cannot_play = 0;
+        for (size_t i = 0, n = size(); i < n; ++i) {
+            int col = cols[i];
+            Word played = col >= 0;
+            int top = ((col >= 0) & (col < W) ? col : 0) * (H + 1) + H - 1;
+            Word full = mask[i] >> top;
+            Word finished = status[i] != GameStatus::InProgress;
+            cannot_play |= played
+                & (static_cast<Word>(col >= W) | finished | full);
+        }
+        return (cannot_play & 1) == 0;
+    }
+
+    CONNECTLIB_MULTIVERSION
+    void playUnchecked(const int* cols) {
+        Word* mask = mask_.data();
+        Word* position = position_.data();
+        int8_t* moves = moves_.data();
+        int8_t* status = status_.data();
+        for (size_t i = 0, n = size(); i < n; ++i) {
+            int col = cols[i];
+            Word played = col >= 0;
+            Word bottom = played << (col >= 0 ? col : 0) * (H + 1);
+            Word new_mask = mask[i] | (mask[i] + bottom);
+            Word new_position = position[i] ^ (mask[i] & (Word(0) - played));
+            int new_moves = moves[i] + static_cast<int>(played);
+            int new_status = hasAlignment(new_position ^ new_mask)
+                ? (new_moves % 2 == 1 ? GameStatus::Player1Wins
+                                      : GameStatus::Player2Wins)
+                : (new_moves == W * H ? GameStatus::Draw : status[i]);
+            mask[i] = new_mask;
+            position[i] = new_position;
+            moves[i] = static_cast<int8_t>(new_moves);
+            status[i] = static_cast<int8_t>(played ? new_status : status[i]);
+        }
+    }
+
+    // Board::hasAlignment() without early returns.
+    static bool hasAlignment(Word pos) {
+        Word horizontal = pos & (pos << (H + 1));
+        Word diagonal1 = pos & (pos << H);
+        Word diagonal2 = pos & (pos << (H + 2));
+        Word vertical = pos & (pos << 1);
+        return ((horizontal & (horizontal << 2 * (H + 1)))
+                | (diagonal1 & (diagonal1 << 2 * H))
+                | (diagonal2 & (diagonal2 << 2 * (H + 2)))
+                | (vertical & (vertical << 2))) != 0;
+    }
+};
+
+typedef BasicBoardBatch<Board::WIDTH, Board::HEIGHT> BoardBatch;
+
+
+// View of a whole file. Its pages live in the OS page cache and are shared by
+// all the processes mapping the same file. The view is read-only unless
+// mapped copy-on-write: the pages that are written to are then privately
+// copied, and the file itself is never modified.
+class MappedFile {
+public:
+    MappedFile(const std::string& filename, bool copy_on_write = false)
+            : data_(nullptr), size_(0) {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ,
+            FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+            nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("Cannot open " + filename);
+        LARGE_INTEGER file_size;
+        GetFileSizeEx(file, &file_size);
+        size_ = static_cast<size_t>(file_size.QuadPart);
+        mapping_ = nullptr;
+        if (size_ > 0) {
+            mapping_ = CreateFileMappingA(file, nullptr,
+                copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY,
+                0, 0, nullptr);
+            if (mapping_ != nullptr)
+                data_ = static_cast<char*>(MapViewOfFile(mapping_,
+                    copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0));
+        }
+        CloseHandle(file);
+        if (size_ > 0 && data_ == nullptr) {
+            if (mapping_ != nullptr)
+                CloseHandle(mapping_);
+            throw std::runtime_error("Cannot map " + filename);
+        }
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open " + filename);
+        struct stat stat_buf;
+        if (fstat(fd, &stat_buf) != 0) {
+            close(fd);
+            throw std::runtime_error("Cannot get size of " + filename);
+        }
+        size_ = stat_buf.st_size;
+        if (size_ > 0) {
+            void* data = copy_on_write
+                ? mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                       fd, 0)
+                : mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Cannot map " + filename);
+            }
+            data_ = static_cast<char*>(data);
+        }
+        close(fd);
+#endif
+    }
+
+    ~MappedFile() {
+        if (data_ == nullptr)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(data_);
+        CloseHandle(mapping_);
+#else
+        munmap(data_, size_);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const {
+        return data_;
+    }
+
+    // Only for copy-on-write views.
+    char* data() {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    char* data_;
+    size_t size_;
+#ifdef _WIN32
+    HANDLE mapping_;
+#endif
+};
+
+
+// Named memory segment shared by all the processes opening it, created
+// zero-filled by the first one. On POSIX systems the segment persists until
+// it is unlinked, on Windows until the last process using it closes it.
+class SharedMemory {
+public:
+    SharedMemory(const std::string& name, size_t size)
+            : data_(nullptr), size_(size), created_(false) {
+#ifdef _WIN32
+        mapping_ = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr,
+            PAGE_READWRITE, static_cast<DWORD>(uint64_t(size) >> 32),
+            static_cast<DWORD>(size), name.c_str());
+        if (mapping_ == nullptr)
+            throw std::runtime_error("Cannot create shared memory " + name);
+        created_ = GetLastError() != ERROR_ALREADY_EXISTS;
+        data_ = static_cast<char*>(
+            MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size));
+        if (data_ == nullptr) {
+            CloseHandle(mapping_);
+            throw std::runtime_error("Cannot map shared memory " + name);
+        }
+#else
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0) {
+            created_ = true;
+            if (ftruncate(fd, size) != 0) {
+                close(fd);
+                shm_unlink(name.c_str());
+                throw std::runtime_error(
+                    "Cannot allocate shared memory " + name);
+            }
+        } else if (errno == EEXIST) {
+            fd = shm_open(name.c_str(), O_RDWR, 0);
+            if (fd < 0)
+                throw std::runtime_error("Cannot open shared memory " + name);
+            // The creator may not have sized it yet.
+            struct stat stat_buf;
+            for (int retry = 0; ; ++retry) {
+                if (fstat(fd, &stat_buf) != 0 || retry == 1000) {
+                    close(fd);
+                    throw std::runtime_error(
+                        "Cannot get size of shared memory " + name);
+                }
+                if (stat_buf.st_size != 0)
+                    break;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            if (static_cast<size_t>(stat_buf.st_size) != size) {
+                close(fd);
+                throw std::runtime_error(
+                    "Shared memory " + name + " exists with another size");
+            }
+        } else {
+            throw std::runtime_error("Cannot create shared memory " + name);
+        }
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+            throw std::runtime_error("Cannot map shared memory " + name);
+        data_ = static_cast<char*>(data);
+#endif
+    }
+
+    ~SharedMemory() {
+#ifdef _WIN32
+        UnmapViewOfFile(data_);
+        CloseHandle(mapping_);
+#else
+        munmap(data_, size_);
+#endif
+    }
+
+    SharedMemory(const SharedMemory&) = delete;
+    SharedMemory& operator=(const SharedMemory&) = delete;
+
+    // Removes the name of a segment: it is freed once unmapped by all the
+    // processes, and the next process opening the name creates a new one.
+    // Does nothing on Windows.
+    static void unlink(const std::string& name) {
+#ifndef _WIN32
+        if (shm_unlink(name.c_str()) != 0 && errno != ENOENT)
+            throw std::runtime_error("Cannot unlink shared memory " + name);
+#else
+        (void)name;
+#endif
+    }
+
+    char* data() {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    // Whether this process created the segment.
+    bool created() const {
+        return created_;
+    }
+
+private:
+    char* data_;
+    size_t size_;
+    bool created_;
+#ifdef _WIN32
+    HANDLE mapping_;
+#endif
+};
+
+
+// Zero-filled memory allocated directly from the OS, page-aligned. Large
+// blocks are backed by huge pages when possible (reserved ones, or else
+// transparent ones on Linux), which saves most of the TLB misses of random
+// accesses. Pages are only allocated on first access, by the thread making
+// it, which places them on the NUMA node of that thread.
+class PageMemory {
+public:
+    explicit PageMemory(size_t size) : data_(nullptr), size_(size) {
+#ifdef _WIN32
+        data_ = static_cast<char*>(VirtualAlloc(nullptr, size,
+            MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+        if (data_ == nullptr)
+            throw std::bad_alloc();
+#else
+        void* data = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        // Only works if huge pages have been reserved (vm.nr_hugepages).
+        const size_t huge_page_size = 2 << 20;
+        if (size >= huge_page_size) {
+            size_t huge_size = (size + huge_page_size - 1)
+                / huge_page_size * huge_page_size;
+            data = mmap(nullptr, huge_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (data != MAP_FAILED)
+                size_ = huge_size;
+        }
+#endif
+        if (data == MAP_FAILED) {
+            data = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (data == MAP_FAILED)
+                throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+            madvise(data, size, MADV_HUGEPAGE);
+#endif
+        }
+        data_ = static_cast<char*>(data);
+#endif
+    }
+
+    ~PageMemory() {
+#ifdef _WIN32
+        VirtualFree(data_, 0, MEM_RELEASE);
+#else
+        munmap(data_, size_);
+#endif
+    }
+
+    PageMemory(const PageMemory&) = delete;
+    PageMemory& operator=(const PageMemory&) = delete;
+
+    char* data() {
+        return data_;
+    }
+
+    // Zero-fills the memory. On Linux, its pages are handed back to the OS
+    // instead, which costs nothing for the pages that were not accessed.
+    // Not thread-safe.
+    void clear() {
+#if defined(__linux__) && defined(MADV_DONTNEED)
+        if (madvise(data_, size_, MADV_DONTNEED) == 0)
+            return;
+#endif
+        std::memset(data_, 0, size_);
+    }
+
+private:
+    char* data_;
+    size_t size_;
+};
+
+
+// Transposition table accesses of one search thread.
+struct TableStats {
+    uint64_t probes;
+    uint64_t hits;
+    // Entries of other positions with the same lowest 32 key bits, which can
+    // only be found for boards whose entries take two words.
+    uint64_t collisions;
+    // Entries of other positions replaced by a new one.
+    uint64_t overwrites;
+
+    TableStats() : probes(0), hits(0), collisions(0), overwrites(0) {}
+
+    void add(const TableStats& other) {
+        probes += other.probes;
+        hits += other.hits;
+        collisions += other.collisions;
+        overwrites += other.overwrites;
+    }
+};
+
+
+// Transposition table for the keys of BasicBoard<W, H, Word>.
+template <int W, int H, class Word = typename BoardWord<W, H>::type>
+class BasicTranspositionTable {
+public:
+    // Entries are grouped by buckets of one cache line. The bucket of a key
+    // is key % num_buckets, num_buckets being prime, and only the lowest
+    // 32 bits of the key are stored. By the Chinese remainder theorem, both
+    // determine the key uniquely as long as num_buckets * 2^32 > key. As
+    // the last column of a key holds at most twice its mask, keys are below
+    // 2^KEY_BITS - 2^(KEY_BITS - H - 1), hence MIN_BUCKETS: smaller tables
+    // are rejected (2^20 entries, 8 MiB, are enough for the 7x6 Board). The
+    // keys of larger boards are not folded in the bucket index: their
+    // entries take a second word, holding the bits above the lowest 32 ones.
+    static const int KEY_BITS = W * (H + 1);
+    static_assert(KEY_BITS <= 96, "");
+    static const int ENTRY_WORDS = KEY_BITS <= 49 ? 1 : 2;
+    static const int BUCKET_SIZE = 8 / ENTRY_WORDS;
+    static const size_t MIN_BUCKETS =
+        ENTRY_WORDS == 2 || KEY_BITS <= 32 ? 1
+        : (static_cast<size_t>(1) << (KEY_BITS > 32 ? KEY_BITS - 32 : 0))
+            - (KEY_BITS - H - 1 >= 32
+               ? static_cast<size_t>(1) << (KEY_BITS - H - 1 >= 32
+                                            ? KEY_BITS - H - 33 : 0)
+               : 0);
+    static_assert(W < 15, "Columns are stored on 4 bits");
+
+    // Lower bound of the entries which only have an upper bound.
+    static const int8_t NO_LOWER_BOUND = INT8_MIN;
+
+    // With a shared_name, the entries live in the named shared memory
+    // segment (e.g. "/connectpy-tt"), created by the first table opening
+    // it, and are shared with the tables of the same size and board
+    // geometry opening it in other processes. As the processes start their
+    // searches independently, entries of a shared table are not aged: the
+    // ones with the most moves played are replaced first.
+    BasicTranspositionTable(size_t size, const std::string& shared_name = "")
+            : generation_(0) {
+        num_buckets_ = previousPrime(
+            std::max<size_t>(2, (size + BUCKET_SIZE - 1) / BUCKET_SIZE));
+        if (num_buckets_ < MIN_BUCKETS)
+            throw std::runtime_error(
+                "Table too small for its entries to identify their keys.");
+        // Magic multiplier for the division-free modulo in bucket().
+        modulo_magic_ = UINT64_MAX / num_buckets_ + 1;
+        if (!shared_name.empty()) {
+            openShared(shared_name);
+            return;
+        }
+        allocate();
+    }
+
+    // Frees a shared table segment once the tables using it are destroyed.
+    static void unlinkShared(const std::string& shared_name) {
+        SharedMemory::unlink(shared_name);
+    }
+
+    // Entries are single 64-bit words, so they can be read and written
+    // concurrently by several search threads (or processes, for a shared
+    // table) without locking: a reader sees either the old or the new entry,
+    // never a mix. The second word of the entries of larger boards is xor-ed
+    // with the first one, so that a mix of two entries is detected as a
+    // different key.
+    //
+    // An existing entry for the key is overwritten. Otherwise an empty slot
+    // is used or, in a full bucket, the entry that is the cheapest to
+    // recompute: preferably one from a previous search, then the one with
+    // the most moves played.
+    //
+    // Entries hold an upper bound of the score of the position, which is
+    // its value, and optionally a lower bound. They also hold the column to
+    // search first in the position (-1 if none). Accesses are counted in
+    // stats, if any, when compiled with CONNECTLIB_STATS.
+    void put(Word key, int8_t value, int8_t lower = NO_LOWER_BOUND,
+             int moves = 0, int move = -1, TableStats* stats = nullptr) {
+        std::atomic<uint64_t>* slots = bucket(key);
+        uint32_t partial_key = static_cast<uint32_t>(key);
+        int victim = 0;
+        int victim_cost = -1;
+        for (int i = 0; i < BUCKET_SIZE; ++i) {
+            uint64_t entry =
+                slots[i * ENTRY_WORDS].load(std::memory_order_relaxed);
+            if (entry == 0 || matches(&slots[i * ENTRY_WORDS], entry, key)) {
+                victim = i;
+                CONNECTLIB_STAT(victim_cost = -1;)
+                break;
+            }
+            int cost = entryMoves(entry)
+                + (entryGeneration(entry) != generation_ ? 64 : 0);
+            if (cost > victim_cost) {
+                victim = i;
+                victim_cost = cost;
+            }
+        }
+        CONNECTLIB_STAT(if (stats && victim_cost >= 0) stats->overwrites++;)
+        uint64_t entry =
+            pack(partial_key, value, lower, moves, generation_, move);
+        slots[victim * ENTRY_WORDS].store(entry, std::memory_order_relaxed);
+        if (ENTRY_WORDS > 1)
+            slots[victim * ENTRY_WORDS + 1].store(
+                entry ^ upperKey(key), std::memory_order_relaxed);
+    }
+
+    // Entry of a key, if found.
+    struct Probe {
+        bool found;
+        int8_t upper;
+        int8_t lower;
+        int move;
+    };
+
+    Probe probe(Word key, TableStats* stats = nullptr) const {
+        const std::atomic<uint64_t>* slots = bucket(key);
+        CONNECTLIB_STAT(if (stats) stats->probes++;)
+        for (int i = 0; i < BUCKET_SIZE; ++i) {
+            uint64_t entry =
+                slots[i * ENTRY_WORDS].load(std::memory_order_relaxed);
+            if (entry != 0 && matches(&slots[i * ENTRY_WORDS], entry, key)) {
+                CONNECTLIB_STAT(if (stats) stats->hits++;)
+                Probe probe = {true, entryValue(entry), entryLower(entry),
+                               entryMove(entry)};
+                return probe;
+            }
+            CONNECTLIB_STAT(
+                if (stats && entry != 0
+                        && entryKey(entry) == static_cast<uint32_t>(key))
+                    stats->collisions++;)
+        }
+        Probe probe = {false, 0, NO_LOWER_BOUND, -1};
+        return probe;
+    }
+
+    std::pair<bool, int8_t> get(Word key) const {
+        Probe probe = this->probe(key);
+        return std::make_pair(probe.found, probe.upper);
+    }
+
+    // Hints the CPU to start loading the bucket of a key that will be
+    // accessed soon.
+    void prefetch(Word key) const {
+#if defined(__GNUC__)
+        __builtin_prefetch(bucket(key));
+#elif defined(_MSC_VER) && defined(_M_X64)
+        _mm_prefetch(reinterpret_cast<const char*>(bucket(key)), _MM_HINT_T0);
+#endif
+    }
+
+    // Starts a new search: entries from previous searches stay valid but
+    // are replaced first.
+    void newSearch() {
+        if (!shared_)
+            generation_ = (generation_ + 1) & 0xF;
+    }
+
+    // Only the pages of the entries written since the last reset are
+    // cleared, unless the table is shared: it is then also emptied for the
+    // other processes. A loaded snapshot is released.
+    void reset() {
+        if (shared_) {
+            for (size_t i = 0; i < num_buckets_ * BUCKET_WORDS; ++i)
+                entries_[i].store(0, std::memory_order_relaxed);
+        } else if (!memory_) {
+            allocate();
+        } else {
+            memory_->clear();
+        }
+    }
+
+    size_t size() const {
+        return num_buckets_ * BUCKET_SIZE;
+    }
+
+    // Writes the entries to a snapshot file, for load(). The snapshot is
+    // written next to the file and then renamed, as the file may be mapped
+    // by this table or by other processes.
+    void save(const std::string& filename) const {
+        SnapshotHeader header = snapshotHeader();
+        std::string tmp_filename = filename + ".tmp";
+        std::ofstream file(tmp_filename, std::ios::binary);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(entries_),
+                   num_buckets_ * BUCKET_WORDS * sizeof(uint64_t));
+        file.close();
+        if (!file)
+            throw std::runtime_error("Cannot write " + tmp_filename);
+#ifdef _WIN32
+        std::remove(filename.c_str());
+#endif
+        if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0)
+            throw std::runtime_error("Cannot write " + filename);
+    }
+
+    // Replaces the entries with the ones of a snapshot written by save() for
+    // a table of the same size and board geometry. The snapshot is mapped
+    // copy-on-write instead of being read: its pages are loaded on first
+    // access, and stay shared with the other processes using it (including
+    // forked ones) until they are modified. A shared table copies the
+    // entries instead.
+    void load(const std::string& filename) {
+        std::unique_ptr<MappedFile> file(new MappedFile(filename, true));
+        SnapshotHeader header;
+        if (file->size() < sizeof(header))
+            throw std::runtime_error("Unexpected size for " + filename);
+        std::memcpy(&header, file->data(), sizeof(header));
+        SnapshotHeader expected = snapshotHeader();
+        if (std::memcmp(header.magic, expected.magic, 8) != 0)
+            throw std::runtime_error("Not a table snapshot: " + filename);
+        if (header.version != expected.version)
+            throw std::runtime_error("Unsupported version for " + filename);
+        if (header.width != expected.width || header.height != expected.height
+                || header.num_buckets != expected.num_buckets)
+            throw std::runtime_error(
+                "Table size or board geometry mismatch for " + filename);
+        if (file->size() != sizeof(header)
+                + num_buckets_ * BUCKET_WORDS * sizeof(uint64_t))
+            throw std::runtime_error("Unexpected size for " + filename);
+
+        if (shared_) {
+            const char* data = file->data() + sizeof(header);
+            for (size_t i = 0; i < num_buckets_ * BUCKET_WORDS; ++i) {
+                uint64_t entry;
+                std::memcpy(&entry, data + i * sizeof(uint64_t),
+                            sizeof(entry));
+                entries_[i].store(entry, std::memory_order_relaxed);
+            }
+            return;
+        }
+        file_ = std::move(file);
+        // The mapping is page-aligned, and the header one cache line.
+        entries_ = reinterpret_cast<std::atomic<uint64_t>*>(
+            file_->data() + sizeof(header));
+        memory_.reset();
+        generation_ = header.generation;
+    }
+
+private:
+    // Entry layout (0 marks an empty slot, which is never a valid entry since
+    // moves + 1 > 0):
+    //   bits 32-63: lowest 32 bits of the key
+    //   bits 24-31: value (upper bound)
+    //   bits 16-23: lower bound
+    //   bits  8-15: moves played in the position, plus one
+    //   bits  4- 7: generation of the search that stored the entry
+    //   bits  0- 3: column to search first, plus one (0 if none)
+    // followed, for larger boards, by (key >> 32) ^ first word.
+    static const int BUCKET_WORDS = 8;
+
+    struct SnapshotHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint32_t generation;
+        uint64_t num_buckets;
+        char padding[32];
+    };
+    static_assert(sizeof(SnapshotHeader) == BUCKET_WORDS * sizeof(uint64_t),
+                  "");
+
+    // Entries, pointing either to memory_, to a snapshot mapped by load() or
+    // to a shared memory segment.
+    std::unique_ptr<PageMemory> memory_;
+    std::unique_ptr<MappedFile> file_;
+    std::unique_ptr<SharedMemory> shared_;
+    std::atomic<uint64_t>* entries_;
+    size_t num_buckets_;
+    uint64_t modulo_magic_;
+    int generation_;
+
+    // The buckets are cache-line aligned as the memory is page-aligned.
+    void allocate() {
+        memory_.reset(new PageMemory(
+            num_buckets_ * BUCKET_WORDS * sizeof(uint64_t)));
+        entries_ = reinterpret_cast<std::atomic<uint64_t>*>(memory_->data());
+        file_.reset();
+    }
+
+    // Shared segments are laid out as snapshots: the header, written by the
+    // process creating the segment, identifies the table size and board
+    // geometry for the other processes.
+    void openShared(const std::string& name) {
+        SnapshotHeader expected = snapshotHeader();
+        shared_.reset(new SharedMemory(name, sizeof(expected)
+            + num_buckets_ * BUCKET_WORDS * sizeof(uint64_t)));
+        char* header = shared_->data();
+        if (shared_->created()) {
+            std::memcpy(header, &expected, sizeof(expected));
+        } else {
+            // Wait for the header if the creator has not written it yet.
+            for (int retry = 0; retry < 1000
+                    && std::memcmp(header, expected.magic, 8) != 0; ++retry)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            if (std::memcmp(header, &expected, sizeof(expected)) != 0)
+                throw std::runtime_error(
+                    "Table size or board geometry mismatch for " + name);
+        }
+        // The mapping is page-aligned, and the header one cache line.
+        entries_ = reinterpret_cast<std::atomic<uint64_t>*>(
+            header + sizeof(expected));
+        if (!entries_[0].is_lock_free())
+            throw std::runtime_error("Cannot share a table between processes");
+    }
+
+    SnapshotHeader snapshotHeader() const {
+        SnapshotHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "C4TABLE\0", 8);
+        header.version = 2;
+        header.width = W;
+        header.height = H;
+        header.generation = generation_;
+        header.num_buckets = num_buckets_;
+        return header;
+    }
+
+    static uint64_t pack(uint32_t partial_key, int8_t value, int8_t lower,
+                         int moves, int generation, int move) {
+        return static_cast<uint64_t>(partial_key) << 32
+            | static_cast<uint64_t>(static_cast<uint8_t>(value)) << 24
+            | static_cast<uint64_t>(static_cast<uint8_t>(lower)) << 16
+            | static_cast<uint64_t>(moves + 1) << 8
+            | static_cast<uint64_t>(generation) << 4
+            | static_cast<uint64_t>(move + 1);
+    }
+
+    static uint32_t entryKey(uint64_t entry) {
+        return static_cast<uint32_t>(entry >> 32);
+    }
+
+    static int8_t entryValue(uint64_t entry) {
+        return static_cast<int8_t>(entry >> 24);
+    }
+
+    static int8_t entryLower(uint64_t entry) {
+        return static_cast<int8_t>(entry >> 16);
+    }
+
+    static int entryGeneration(uint64_t entry) {
+        return (entry >> 4) & 0xF;
+    }
+
+    static int entryMoves(uint64_t entry) {
+        return ((entry >> 8) & 0xFF) - 1;
+    }
+
+    static int entryMove(uint64_t entry) {
+        return static_cast<int>(entry & 0xF) - 1;
+    }
+
+    static uint64_t upperKey(Word key) {
+        return static_cast<uint64_t>(key >> 32);
+    }
+
+    // Whether a non-empty entry, starting at slot, is the one of the key.
+    static bool matches(const std::atomic<uint64_t>* slot, uint64_t entry,
+                        Word key) {
+        return entryKey(entry) == static_cast<uint32_t>(key)
+            && (ENTRY_WORDS == 1
+                || (slot[1].load(std::memory_order_relaxed) ^ entry)
+                    == upperKey(key));
+    }
+
+    std::atomic<uint64_t>* bucket(Word key) const {
+        // key % num_buckets_ without a division: the quotient estimated
+        // from the magic multiplier is exact or one too large, in which case
+        // the remainder wraps around and is corrected. Keys of more than 64
+        // bits, which are fully stored in their entries, are folded first.
+        uint64_t folded = foldKey(key);
+        uint64_t quotient = mulhi(folded, modulo_magic_);
+        int64_t remainder =
+            static_cast<int64_t>(folded - quotient * num_buckets_);
+        remainder += (remainder >> 63) & static_cast<int64_t>(num_buckets_);
+        return entries_ + remainder * BUCKET_WORDS;
+    }
+
+    static uint64_t foldKey(uint64_t key) {
+        return key;
+    }
+
+#ifdef CONNECTLIB_HAS_UINT128
+    static uint64_t foldKey(uint128_t key) {
+        return static_cast<uint64_t>(key)
+            ^ static_cast<uint64_t>(key >> 64) * UINT64_C(0x9E3779B97F4A7C15);
+    }
+#endif
+
+    static uint64_t mulhi(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+        return static_cast<uint64_t>(
+            (static_cast<unsigned __int128>(a) * b) >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+        return __umulh(a, b);
+#else
+        uint64_t a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+        uint64_t b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+        uint64_t mid = (a_lo * b_lo >> 32) + (a_hi * b_lo & 0xFFFFFFFF)
+            + a_lo * b_hi;
+        return a_hi * b_hi + (a_hi * b_lo >> 32) + (mid >> 32);
+#endif
+    }
+
+    static size_t previousPrime(size_t n) {
+        for (;; --n) {
+            bool is_prime = n >= 2;
+            for (size_t d = 2; is_prime && d * d <= n; ++d)
+                is_prime = n % d != 0;
+            if (is_prime)
+                return n;
+        }
+    }
+};
+
+typedef BasicTranspositionTable<Board::WIDTH, Board::HEIGHT>
+    TranspositionTable;
+
+
+class OpeningBook {
+public:
+    // Generates the book. The unique positions at the maximum depth are
+    // solved first by a pool of threads (threads == 0 meaning one per core),
+    // then their scores are backed up to the shallower positions. Solved
+    // positions are regularly appended to the checkpoint file, if any, from
+    // which an interrupted generation resumes.
+    OpeningBook(size_t depth, int threads = 0, std::string checkpoint = "");
+
+    // Loads a book in any format written by dump() or dumpCompact(),
+    // possibly compressed with gzip. Uncompressed books in the mapped and
+    // compact formats are used in place, without copying their content.
+    OpeningBook(std::string filename)
+            : weak_(false), blocks_(nullptr), num_blocks_(0) {
+        file_.reset(new MappedFile(filename));
+        const char* data = file_->data();
+        size_t file_size = file_->size();
+        if (file_size >= 2 && static_cast<uint8_t>(data[0]) == 0x1F
+                && static_cast<uint8_t>(data[1]) == 0x8B) {
+            file_.reset();
+            file_size = gunzip(filename, owned_data_);
+            data = reinterpret_cast<const char*>(owned_data_.data());
+        }
+
+        MappedHeader header;
+        if (file_size >= sizeof(header)) {
+            std::memcpy(&header, data, sizeof(header));
+        }
+        if (file_size >= sizeof(header)
+                && std::memcmp(header.magic, MAPPED_MAGIC, 8) == 0) {
+            if (header.version == COMPACT_VERSION) {
+                loadCompact(data, file_size, filename);
+                return;
+            }
+            if (header.version != MAPPED_VERSION)
+                throw std::runtime_error("Unsupported version for " + filename);
+            if (file_size != sizeof(header) + header.size * 9)
+                throw std::runtime_error("Unexpected size for " + filename);
+            depth_ = header.depth;
+            size_ = header.size;
+            keys_ = reinterpret_cast<const uint64_t*>(data + sizeof(header));
+            scores_ = reinterpret_cast<const int8_t*>(keys_ + size_);
+            return;
+        }
+
+        // Legacy format: depth, then (key, score) pairs of 9 bytes.
+        if (file_size % 9 != 1)
+            throw std::runtime_error("Unexpected size for " + filename);
+        depth_ = static_cast<int8_t>(data[0]);
+        std::vector<std::pair<uint64_t, int8_t>> entries((file_size - 1) / 9);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            std::memcpy(&entries[i].first, data + 1 + 9 * i, sizeof(uint64_t));
+            entries[i].second = static_cast<int8_t>(data[1 + 9 * i + 8]);
+        }
+        file_.reset();
+        std::vector<uint64_t>().swap(owned_data_);
+        setEntries(std::move(entries));
+    }
+
+    OpeningBook(const OpeningBook&) = delete;
+    OpeningBook& operator=(const OpeningBook&) = delete;
+
+    // Writes the book either in the legacy format (depth, then key-score
+    // pairs) or in the mapped format (header, sorted keys, then scores)
+    // that can be used without being copied in memory.
+    void dump(std::string filename, bool mapped = false) const {
+        if (weak_)
+            throw std::runtime_error(
+                "Weak books can only be written in the compact format.");
+        std::vector<std::pair<uint64_t, int8_t>> entries = this->entries();
+        std::ofstream file(filename, std::ios::binary);
+        if (mapped) {
+            MappedHeader header;
+            std::memcpy(header.magic, MAPPED_MAGIC, 8);
+            header.version = MAPPED_VERSION;
+            header.depth = depth_;
+            header.size = size_;
+            file.write(reinterpret_cast<const char *>(&header),
+                       sizeof(header));
+            for (const auto& entry : entries)
+                file.write(reinterpret_cast<const char *>(&entry.first),
+                           sizeof(entry.first));
+            for (const auto& entry : entries)
+                file.write(reinterpret_cast<const char *>(&entry.second),
+                           sizeof(entry.second));
+            file.close();
+            return;
+        }
+
+        // Header.
+        int8_t depth_as_int8 = depth_;
+        file.write(reinterpret_cast<const char *>(&depth_as_int8),
+                   sizeof(depth_as_int8));
+
+        // Key-score pairs (sorted by keys).
+        for (const auto& entry : entries) {
+            file.write(reinterpret_cast<const char *>(&entry.first),
+                       sizeof(entry.first));
+            file.write(reinterpret_cast<const char *>(&entry.second),
+                       sizeof(entry.second));
+        }
+        file.close();
+    }
+
+    // Writes the book in the compact format: the sorted keys are split in
+    // blocks of COMPACT_BLOCK_SIZE, each stored as its first key (in an
+    // index searched by bisection) and the varint-encoded differences
+    // between the next ones; the scores are packed on 6 bits, or on 2 bits
+    // (win, draw or loss) for a weak book. Lookups only decode one block.
+    void dumpCompact(std::string filename, bool weak = false) const {
+        if (weak_ && !weak)
+            throw std::runtime_error("A weak book has no exact scores.");
+        std::vector<std::pair<uint64_t, int8_t>> entries = this->entries();
+        CompactHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, MAPPED_MAGIC, 8);
+        header.version = COMPACT_VERSION;
+        header.depth = depth_;
+        header.size = size_;
+        header.score_bits = weak ? 2 : 6;
+        header.block_size = COMPACT_BLOCK_SIZE;
+        header.num_blocks =
+            (size_ + COMPACT_BLOCK_SIZE - 1) / COMPACT_BLOCK_SIZE;
+
+        std::vector<CompactBlock> blocks(header.num_blocks);
+        std::string key_deltas;
+        std::vector<uint64_t> packed_scores(
+            (size_ * header.score_bits + 63) / 64);
+        for (size_t i = 0; i < size_; ++i) {
+            uint64_t key = entries[i].first;
+            if (i % COMPACT_BLOCK_SIZE == 0) {
+                blocks[i / COMPACT_BLOCK_SIZE].first_key = key;
+                blocks[i / COMPACT_BLOCK_SIZE].offset = key_deltas.size();
+            } else {
+                for (uint64_t delta = key - entries[i - 1].first;;
+                        delta >>= 7) {
+                    if (delta < 0x80) {
+                        key_deltas.push_back(static_cast<char>(delta));
+                        break;
+                    }
+                    key_deltas.push_back(static_cast<char>(delta | 0x80));
+                }
+            }
+            int score = entries[i].second;
+            uint64_t code = weak ? (score > 0) - (score < 0) + 1 : score + 32;
+            size_t bit = i * header.score_bits;
+            packed_scores[bit / 64] |= code << (bit % 64);
+            if (bit % 64 + header.score_bits > 64)
+                packed_scores[bit / 64 + 1] |= code >> (64 - bit % 64);
+        }
+        // Keep the scores aligned on 8 bytes.
+        key_deltas.resize((key_deltas.size() + 7) / 8 * 8);
+        header.key_bytes = key_deltas.size();
+
+        std::ofstream file(filename, std::ios::binary);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(blocks.data()),
+                   blocks.size() * sizeof(CompactBlock));
+        file.write(key_deltas.data(), key_deltas.size());
+        file.write(reinterpret_cast<const char *>(packed_scores.data()),
+                   packed_scores.size() * sizeof(uint64_t));
+        file.close();
+        if (!file)
+            throw std::runtime_error("Cannot write " + filename);
+    }
+
+    // Converts a book to the mapped format.
+    static void convert(std::string filename, std::string mapped_filename) {
+        OpeningBook(filename).dump(mapped_filename, true);
+    }
+
+    std::pair<bool, int8_t> get(const Board& B) const {
+        if ((unsigned)B.getMoves() > depth_) {
+            // We know we do not have this key.
+            return std::make_pair(false, 0);
+        }
+        int8_t score;
+        if (find(B.key(), score) || find(B.symmetricKey(), score))
+            return std::make_pair(true, score);
+        // Not found, even with the symmetric key.
+        return std::make_pair(false, 0);
+    }
+
+    size_t getDepth() const {
+        return depth_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    // Weak books only store the sign of the scores: 1 for a win, 0 for a
+    // draw and -1 for a loss.
+    bool isWeak() const {
+        return weak_;
+    }
+
+private:
+    struct MappedHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t depth;
+        uint64_t size;
+    };
+    static constexpr const char* MAPPED_MAGIC = "C4BOOK\0\0";
+    static const uint32_t MAPPED_VERSION = 1;
+
+    // The compact format starts like the mapped one, with another version.
+    struct CompactHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t depth;
+        uint64_t size;
+        uint32_t score_bits;
+        uint32_t block_size;
+        uint64_t num_blocks;
+        uint64_t key_bytes;
+    };
+    struct CompactBlock {
+        uint64_t first_key;
+        // Of the differences of the next keys in the key deltas.
+        uint64_t offset;
+    };
+    static const uint32_t COMPACT_VERSION = 2;
+    static const uint32_t COMPACT_BLOCK_SIZE = 64;
+
+    size_t depth_;
+    size_t size_;
+    bool weak_;
+    // Sorted keys and corresponding scores, pointing either to the mapped
+    // file or to the vectors below.
+    const uint64_t* keys_;
+    const int8_t* scores_;
+    // Or, for a book in the compact format, its blocks, key deltas and
+    // packed scores.
+    const CompactBlock* blocks_;
+    size_t num_blocks_;
+    const uint8_t* key_deltas_;
+    const uint64_t* packed_scores_;
+    int score_bits_;
+    std::unique_ptr<MappedFile> file_;
+    // Content of a compressed file, as 64-bit words for the alignment.
+    std::vector<uint64_t> owned_data_;
+    std::vector<uint64_t> owned_keys_;
+    std::vector<int8_t> owned_scores_;
+
+    bool find(uint64_t key, int8_t& score) const {
+        if (blocks_ == nullptr) {
+            const uint64_t* found =
+                std::lower_bound(keys_, keys_ + size_, key);
+            if (found == keys_ + size_ || *found != key)
+                return false;
+            score = scores_[found - keys_];
+            return true;
+        }
+
+        // Last block starting at key or before.
+        const CompactBlock* block = std::upper_bound(
+            blocks_, blocks_ + num_blocks_, key,
+            [](uint64_t k, const CompactBlock& b) { return k < b.first_key; });
+        if (block == blocks_)
+            return false;
+        --block;
+        size_t i = (block - blocks_) * COMPACT_BLOCK_SIZE;
+        size_t end = std::min<size_t>(i + COMPACT_BLOCK_SIZE, size_);
+        const uint8_t* delta = key_deltas_ + block->offset;
+        uint64_t block_key = block->first_key;
+        while (block_key < key && ++i < end)
+            block_key += readVarint(delta);
+        if (block_key != key)
+            return false;
+        score = compactScore(i);
+        return true;
+    }
+
+    static uint64_t readVarint(const uint8_t*& p) {
+        uint64_t value = 0;
+        for (int shift = 0;; shift += 7) {
+            uint8_t byte = *p++;
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (byte < 0x80)
+                return value;
+        }
+    }
+
+    int8_t compactScore(size_t i) const {
+        size_t bit = i * score_bits_;
+        uint64_t code = packed_scores_[bit / 64] >> (bit % 64);
+        if (bit % 64 + score_bits_ > 64)
+            code |= packed_scores_[bit / 64 + 1] << (64 - bit % 64);
+        code &= (1u << score_bits_) - 1;
+        return static_cast<int8_t>(weak_ ? int(code) - 1 : int(code) - 32);
+    }
+
+    void loadCompact(const char* data, size_t data_size,
+                     const std::string& filename) {
+        CompactHeader header;
+        if (data_size < sizeof(header))
+            throw std::runtime_error("Unexpected size for " + filename);
+        std::memcpy(&header, data, sizeof(header));
+        if ((header.score_bits != 2 && header.score_bits != 6)
+                || header.block_size != COMPACT_BLOCK_SIZE
+                || header.num_blocks
+                    != (header.size + COMPACT_BLOCK_SIZE - 1)
+                        / COMPACT_BLOCK_SIZE
+                || header.key_bytes % 8 != 0)
+            throw std::runtime_error("Invalid header for " + filename);
+        size_t scores_words = (header.size * header.score_bits + 63) / 64;
+        if (data_size != sizeof(header)
+                + header.num_blocks * sizeof(CompactBlock) + header.key_bytes
+                + scores_words * sizeof(uint64_t))
+            throw std::runtime_error("Unexpected size for " + filename);
+        depth_ = header.depth;
+        size_ = header.size;
+        weak_ = header.score_bits == 2;
+        score_bits_ = header.score_bits;
+        num_blocks_ = header.num_blocks;
+        blocks_ = reinterpret_cast<const CompactBlock*>(data + sizeof(header));
+        key_deltas_ = reinterpret_cast<const uint8_t*>(blocks_ + num_blocks_);
+        packed_scores_ = reinterpret_cast<const uint64_t*>(
+            key_deltas_ + header.key_bytes);
+        keys_ = nullptr;
+        scores_ = nullptr;
+    }
+
+    // Sorted (key, score) pairs.
+    std::vector<std::pair<uint64_t, int8_t>> entries() const {
+        std::vector<std::pair<uint64_t, int8_t>> entries(size_);
+        const uint8_t* delta = nullptr;
+        for (size_t i = 0; i < size_; ++i) {
+            if (blocks_ == nullptr) {
+                entries[i] = std::make_pair(keys_[i], scores_[i]);
+            } else if (i % COMPACT_BLOCK_SIZE == 0) {
+                const CompactBlock& block = blocks_[i / COMPACT_BLOCK_SIZE];
+                entries[i] = std::make_pair(block.first_key, compactScore(i));
+                delta = key_deltas_ + block.offset;
+            } else {
+                entries[i] = std::make_pair(
+                    entries[i - 1].first + readVarint(delta),
+                    compactScore(i));
+            }
+        }
+        return entries;
+    }
+
+    // Reads a gzip-compressed file by chunks into data. Returns the
+    // decompressed size.
+    static size_t gunzip(const std::string& filename,
+                         std::vector<uint64_t>& data) {
+#ifdef CONNECTLIB_ZLIB
+        gzFile file = gzopen(filename.c_str(), "rb");
+        if (file == nullptr)
+            throw std::runtime_error("Cannot open " + filename);
+        gzbuffer(file, 1 << 17);
+        size_t size = 0;
+        data.resize(1 << 17);
+        for (;;) {
+            if (size == data.size() * sizeof(uint64_t))
+                data.resize(2 * data.size());
+            unsigned chunk = static_cast<unsigned>(std::min<size_t>(
+                data.size() * sizeof(uint64_t) - size, 1 << 30));
+            int read = gzread(
+                file, reinterpret_cast<char*>(data.data()) + size, chunk);
+            if (read < 0) {
+                gzclose(file);
+                throw std::runtime_error("Cannot decompress " + filename);
+            }
+            if (read == 0)
+                break;
+            size += read;
+        }
+        gzclose(file);
+        return size;
+#else
+        (void)data;
+        throw std::runtime_error(
+            "Compiled without zlib (CONNECTLIB_ZLIB), cannot read " + filename);
+#endif
+    }
+
+    template <class Entries>
+    void setEntries(Entries entries) {
+        std::vector<std::pair<uint64_t, int8_t>> sorted(
+            entries.begin(), entries.end());
+        std::sort(sorted.begin(), sorted.end());
+        owned_keys_.resize(sorted.size());
+        owned_scores_.resize(sorted.size());
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            owned_keys_[i] = sorted[i].first;
+            owned_scores_[i] = sorted[i].second;
+        }
+        size_ = sorted.size();
+        keys_ = owned_keys_.data();
+        scores_ = owned_scores_.data();
+    }
+
+    // Canonical keys of the unique positions in progress at maximum depth.
+    std::vector<uint64_t> enumerateFrontier() const {
+        std::vector<uint64_t> level(1, Board().canonicalKey());
+        for (size_t moves = 0; moves < depth_; ++moves) {
+            std::vector<uint64_t> next_level;
+            for (uint64_t key : level) {
+                Board B(key);
+                for (int col = 0; col < Board::WIDTH; ++col) {
+                    if (B.canPlay(col)) {
+                        Board B2(B);
+                        B2.play(col);
+                        if (B2.getStatus() == Board::Status::InProgress)
+                            next_level.push_back(B2.canonicalKey());
+                    }
+                }
+            }
+            std::sort(next_level.begin(), next_level.end());
+            next_level.erase(std::unique(next_level.begin(), next_level.end()),
+                             next_level.end());
+            level.swap(next_level);
+        }
+        return level;
+    }
+
+    // Renames from over to, atomically where supported.
+    static bool replaceFile(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+        return MoveFileExA(from.c_str(), to.c_str(),
+                           MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+    }
+
+    // Checkpoint files are a sequence of 9-byte (key, score) records. A
+    // truncated last record, from an interrupted write, is ignored.
+    static std::unordered_map<uint64_t, int8_t> readCheckpoint(
+            const std::string& checkpoint) {
+        std::unordered_map<uint64_t, int8_t> scores;
+        std::ifstream file(checkpoint, std::ios::binary);
+        if (checkpoint.empty() || !file)
+            return scores;
+        std::string data((std::istreambuf_iterator<char>(file)),
+                         std::istreambuf_iterator<char>());
+        for (size_t i = 0; i + 9 <= data.size(); i += 9) {
+            uint64_t key;
+            std::memcpy(&key, &data[i], sizeof(key));
+            scores[key] = static_cast<int8_t>(data[i + 8]);
+        }
+        return scores;
+    }
+
+    std::unordered_map<uint64_t, int8_t> solveFrontier(
+            int threads, const std::string& checkpoint) const;
+
+    // Computes the scores of the positions up to the maximum depth from the
+    // ones at maximum depth, with one negamax step per position.
+    int8_t backup(const Board& B, std::unordered_map<uint64_t, int8_t>& book,
+                  const std::unordered_map<uint64_t, int8_t>& frontier_scores);
+};
+
+
+// Opening books only exist for the standard board: the solvers of the other
+// geometries use this empty one.
+template <class Board>
+class NoOpeningBook {
+public:
+    std::pair<bool, int8_t> get(const Board&) const {
+        return std::make_pair(false, 0);
+    }
+
+    size_t getDepth() const {
+        return 0;
+    }
+
+    bool isWeak() const {
+        return false;
+    }
+};
+
+template <class Board>
+struct OpeningBookOf {
+    typedef NoOpeningBook<Board> type;
+};
+
+template <>
+struct OpeningBookOf<Board> {
+    typedef OpeningBook type;
+};
+
+
+template <int W, int H, class Word = typename BoardWord<W, H>::type>
+class BasicSolver {
+public:
+    typedef BasicBoard<W, H, Word> Board;
+    typedef BasicTranspositionTable<W, H, Word> TranspositionTable;
+    typedef typename OpeningBookOf<Board>::type Book;
+
+    // By default, use a table size of 64 MiB. Positions found in the
+    // opening book, if any, are not searched. With shared_tt, the table is
+    // shared with the solvers of other processes using the same name (see
+    // TranspositionTable).
+    BasicSolver(int threads = 1, size_t tt_mib = 64,
+                std::shared_ptr<const Book> book = nullptr,
+                const std::string& shared_tt = "") : BasicSolver(
+            std::make_shared<TranspositionTable>(
+                tableSize(threads, tt_mib), shared_tt),
+            book, nullptr, 0) {
+        // Lazy SMP: helpers run the same searches as this solver and only
+        // communicate through the shared transposition table. Each one has
+        // its own thread, kept from one search to the next.
+        for (int i = 1; i < threads; ++i)
+            helpers_.emplace_back(
+                new BasicSolver(max_score_table_, book_, &stop_flag_, i));
+        for (auto& helper : helpers_)
+            helper_threads_.emplace_back(
+                &BasicSolver::runHelper, this, helper.get());
+    }
+
+    ~BasicSolver() {
+        {
+            std::lock_guard<std::mutex> lock(helper_mutex_);
+            helpers_exit_ = true;
+        }
+        helper_wake_.notify_all();
+        for (auto& thread : helper_threads_)
+            thread.join();
+    }
+
+    BasicSolver(const BasicSolver&) = delete;
+    BasicSolver& operator=(const BasicSolver&) = delete;
+
+    int negamax(const Board& B) {
+        int max_score = Board::WIDTH * Board::HEIGHT / 2;
+        return withHelpers([&B, max_score](BasicSolver& s) {
+            return s.negamax(B, -max_score, max_score); });
+    }
+
+    // With best_move, the move giving a score of beta or more is stored
+    // there, if found (the opening book is then not used for B).
+    CONNECTLIB_MULTIVERSION
+    int negamax(const Board& B, int alpha, int beta,
+                int* best_move = nullptr) {
+        num_explored_pos_++;
+        CONNECTLIB_STAT(stats_.nodes[B.getMoves()]++;)
+        if (num_explored_pos_ > node_limit_)
+            stop_flag_.store(true, std::memory_order_relaxed);
+        if (stop_->load(std::memory_order_relaxed))
+            return 0;
+
+        // Check board status.
+        if (B.getStatus() != Board::Status::InProgress)
+            return finishedScore(B);
+
+        // Exact score from the opening book. Only shallow positions can be
+        // found, as the search never decreases the number of moves.
+        if (book_ && (unsigned)B.getMoves() <= book_->getDepth()
+                && best_move == nullptr) {
+            std::pair<bool, int8_t> found = book_->get(B);
+            if (found.first) {
+                if (!book_->isWeak() || found.second == 0)
+                    return found.second;
+                // A weak book only gives the sign of the score, which
+                // bounds it.
+                if (found.second > 0)
+                    alpha = std::max(alpha, 1);
+                else
+                    beta = std::min(beta, -1);
+                if (alpha >= beta)
+                    return found.second > 0 ? alpha : beta;
+            }
+        }
+
+        // Shortcut if direct win.
+        int max_score = (1 + Board::WIDTH * Board::HEIGHT - B.getMoves()) / 2;
+        for (int col = 0; col < Board::WIDTH; ++col) {
+            if (B.canPlay(col) && B.isWinningMove(col)) {
+                if (best_move)
+                    *best_move = col;
+                return max_score;
+            }
+        }
+        // Cannot win directly, max score decreases.
+        max_score--;
+
+        Word next = B.candidatesMask();
+        if (next == 0) {
+            // No possible other move without losing. Opponent wins next move.
+            return -(Board::WIDTH * Board::HEIGHT - B.getMoves()) / 2;
+        }
+
+        // In symmetric mode, a board and its mirror image share the entry
+        // of the smallest of their keys, the column of which is mirrored
+        // (mirrored is then true) when it is the key of the mirror image.
+        Word key = B.key();
+        bool mirrored = false;
+        bool symmetric_board = false;
+        if (symmetric_) {
+            Word symmetric_key = Board::mirrorKey(key);
+            symmetric_board = symmetric_key == key;
+            mirrored = symmetric_key < key;
+            if (mirrored)
+                key = symmetric_key;
+        }
+
+        // Possibly reduce further max_score using the transposition table,
+        // which also gives the move to search first, if any.
+        typename TranspositionTable::Probe found =
+            max_score_table_->probe(key, &stats_.table);
+        found.move = mirrorMove(found.move, mirrored);
+        if (found.found)
+            max_score = found.upper;
+
+        // Prune beta with max score.
+        if (max_score < beta) {
+            beta = max_score;
+            if (alpha >= beta) {
+                // Empty alpha-beta range.
+                return beta;
+            }
+        }
+
+        // Prune alpha with the lower bound proven by previous searches, if
+        // any (except for best_move, which needs a search).
+        int min_score = found.lower;
+        if (min_score > alpha && best_move == nullptr) {
+            alpha = min_score;
+            if (alpha >= beta) {
+                // Empty alpha-beta range.
+                return alpha;
+            }
+        }
+
+        // Optimize column exploration: the move from the transposition table
+        // first, then by winning opportunities created. The moves of a
+        // symmetric board lead to the mirror images of each other: only
+        // the left half is searched.
+        MoveSorter sorted_moves;
+        for (int i = 0; i < Board::WIDTH; ++i) {
+            int col = column_order_[i];
+            Word move = next & Board::columnMask(col);
+            if (move && !(symmetric_board && 2 * col >= Board::WIDTH)) {
+                sorted_moves.add(col, col == found.move ? INT_MAX
+                                 : B.countWinOpportunities(move));
+                max_score_table_->prefetch(tableKey(B.keyAfter(move)));
+            }
+        }
+
+        // Recursive exploration.
+        for (auto it = sorted_moves.begin(); it != sorted_moves.end(); it++) {
+            Board B2(B);
+            B2.play(it->move, false);
+            int score = -negamax(B2, -beta, -alpha);
+            if (stop_->load(std::memory_order_relaxed)) {
+                // Interrupted helper: the score is meaningless and must not
+                // be stored in the shared table.
+                return 0;
+            }
+            if (score >= beta) {
+                // Outside research range (can happen for weak solver).
+                CONNECTLIB_STAT(
+                    stats_.cutoffs[B.getMoves()]++;
+                    if (it == sorted_moves.begin())
+                        stats_.first_move_cutoffs++;)
+                if (best_move)
+                    *best_move = it->move;
+                // The score is at least the one of the refutation, which is
+                // searched first on re-visits, notably by the next
+                // null-window searches of dichotomicSolve().
+                max_score_table_->put(key, max_score,
+                                      std::max(score, min_score), B.getMoves(),
+                                      mirrorMove(it->move, mirrored),
+                                      &stats_.table);
+                return beta;
+            } else if (score > alpha) {
+                // Prune alpha (keeps track of best score).
+                alpha = score;
+                min_score = score;
+                found.move = it->move;
+            }
+        }
+
+        // alpha: best score obtained, which is exact if a move reached it.
+        max_score_table_->put(key, alpha, min_score, B.getMoves(),
+                              mirrorMove(found.move, mirrored),
+                              &stats_.table);
+        return alpha;
+    }
+
+    int dichotomicSolve(const Board& B, bool use_weak_solver = false) {
+        return withHelpers([&B, use_weak_solver](BasicSolver& s) {
+            return s.dichotomicSearch(B, use_weak_solver); });
+    }
+
+    // Bounds of the score proven by solve(), and a move (-1 if the game is
+    // over) guaranteeing the lower bound.
+    struct SolveResult {
+        int min_score;
+        int max_score;
+        int best_move;
+    };
+
+    // Same search as dichotomicSolve(), stopped after deadline_ms
+    // milliseconds or max_nodes positions explored by this thread (0 for no
+    // limit), or by cancel(). The bounds are then the ones proven by the
+    // null-window searches done so far, and are equal otherwise.
+    //
+    // The deadline is enforced by a timer thread which sets the flag that
+    // the search already checks at each position, so that the search stops
+    // right after it.
+    SolveResult solve(const Board& B, double deadline_ms = 0,
+                      uint64_t max_nodes = 0, bool use_weak_solver = false) {
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::time_point::max();
+        if (deadline_ms > 0) {
+            deadline = std::chrono::steady_clock::now()
+                + std::chrono::duration_cast<
+                    std::chrono::steady_clock::duration>(
+                        std::chrono::duration<double, std::milli>(
+                            deadline_ms));
+        }
+        if (max_nodes > 0)
+            node_limit_ = num_explored_pos_ + max_nodes;
+        SolveResult result = withHelpers(
+            [&B, use_weak_solver](BasicSolver& s) {
+                return s.boundedSearch(B, use_weak_solver); },
+            deadline);
+        node_limit_ = UINT64_MAX;
+        return result;
+    }
+
+    // Stops a search running in another thread (any of negamax(),
+    // dichotomicSolve(), analyze() or solve()) as soon as possible. Only
+    // solve() then gives a meaningful result. Without search_id, stops the
+    // running search, if any. Otherwise stops the search of this id (see
+    // nextSearchId()) even if it has not started yet, so that a cancel()
+    // racing with the start of the search is not lost.
+    void cancel(uint64_t search_id = 0) {
+        std::lock_guard<std::mutex> lock(cancel_mutex_);
+        if (search_id == 0) {
+            if (!searching_)
+                return;
+            search_id = search_id_;
+        }
+        cancelled_id_ = std::max(cancelled_id_, search_id);
+        if (searching_ && search_id == search_id_)
+            stop_flag_.store(true);
+    }
+
+    // Id of the next search to start, for cancel(). Only meaningful when a
+    // single thread starts the searches.
+    uint64_t nextSearchId() const {
+        std::lock_guard<std::mutex> lock(cancel_mutex_);
+        return search_id_ + 1;
+    }
+
+    // Marks the columns that cannot be played in analyze().
+    static const int INVALID_SCORE = 127;
+
+    // Scores obtained by playing each column, from the point of view of the
+    // current player. The score of the position is computed first: it
+    // bounds the score of every column, which narrows their searches, and
+    // they all reuse the transposition table. With best_only, the columns
+    // are only tested for reaching the score of the position, until one of
+    // them does; the others are left to INVALID_SCORE.
+    std::vector<int> analyze(const Board& B, bool best_only = false) {
+        return withHelpers([&B, best_only](BasicSolver& s) {
+            return s.analyzeSearch(B, best_only); });
+    }
+
+    // Score of a finished game: a draw, or a win of the previous player.
+    static int finishedScore(const Board& B) {
+        if (B.getStatus() == Board::Status::Draw)
+            return 0;
+        return (B.getMoves() - Board::WIDTH * Board::HEIGHT) / 2 - 1;
+    }
+
+    uint64_t getNumExploredPos() const {
+        uint64_t num_explored_pos = num_explored_pos_;
+        for (const auto& helper : helpers_)
+            num_explored_pos += helper->num_explored_pos_;
+        return num_explored_pos;
+    }
+
+    // Statistics of the searches since the last reset(), collected by
+    // each thread and summed here (the iteration times are the ones of the
+    // main thread, for the last search).
+    struct Stats {
+        // Only collected with CONNECTLIB_STATS.
+        TableStats table;
+        // By number of moves played in the position.
+        uint64_t nodes[Board::WIDTH * Board::HEIGHT + 1];
+        uint64_t cutoffs[Board::WIDTH * Board::HEIGHT + 1];
+        // Cutoffs by the first move tried.
+        uint64_t first_move_cutoffs;
+
+        // Null-window searches of dichotomicSolve().
+        uint64_t iterations;
+        std::vector<double> iteration_seconds;
+
+        Stats() : nodes(), cutoffs(), first_move_cutoffs(0), iterations(0) {}
+
+        void add(const Stats& other) {
+            table.add(other.table);
+            for (int i = 0; i <= Board::WIDTH * Board::HEIGHT; ++i) {
+                nodes[i] += other.nodes[i];
+                cutoffs[i] += other.cutoffs[i];
+            }
+            first_move_cutoffs += other.first_move_cutoffs;
+            iterations += other.iterations;
+        }
+    };
+
+    Stats getStats() const {
+        Stats stats = stats_;
+        for (const auto& helper : helpers_)
+            stats.add(helper->stats_);
+        return stats;
+    }
+
+    int getNumThreads() const {
+        return 1 + static_cast<int>(helpers_.size());
+    }
+
+    // In symmetric mode, mirror images share their transposition table
+    // entry, and only half of the moves of symmetric boards are searched.
+    // The entries do not depend on the mode, which can be changed at any
+    // time.
+    bool isSymmetric() const {
+        return symmetric_;
+    }
+
+    void setSymmetric(bool symmetric) {
+        symmetric_ = symmetric;
+        for (auto& helper : helpers_)
+            helper->symmetric_ = symmetric;
+    }
+
+    void reset() {
+        num_explored_pos_ = 0;
+        stats_ = Stats();
+        for (auto& helper : helpers_) {
+            helper->num_explored_pos_ = 0;
+            helper->stats_ = Stats();
+        }
+        max_score_table_->reset();
+    }
+
+    // Snapshots of the transposition table, to start another solver (of the
+    // same table size) with the scores already computed by this one.
+    void saveTable(const std::string& filename) const {
+        max_score_table_->save(filename);
+    }
+
+    void loadTable(const std::string& filename) {
+        max_score_table_->load(filename);
+    }
+
+private:
+    uint64_t num_explored_pos_;
+    Stats stats_;
+    int column_order_[Board::WIDTH];
+    bool symmetric_;
+    std::shared_ptr<TranspositionTable> max_score_table_;
+    std::shared_ptr<const Book> book_;
+
+    // Set when the main search is done, has run out of time or nodes, or is
+    // cancelled; the main search and the helpers then abandon it.
+    std::atomic<bool> stop_flag_;
+    // Searches are numbered from 1. Guarded by cancel_mutex_.
+    mutable std::mutex cancel_mutex_;
+    uint64_t search_id_;
+    uint64_t cancelled_id_;
+    bool searching_;
+    uint64_t node_limit_;
+    const std::atomic<bool>* stop_;
+    std::vector<std::unique_ptr<BasicSolver>> helpers_;
+    // Pool of the helper threads: each search increments helper_round_,
+    // which wakes them up to run helper_search_ on their helper.
+    std::vector<std::thread> helper_threads_;
+    std::mutex helper_mutex_;
+    std::condition_variable helper_wake_;
+    std::condition_variable helper_done_;
+    std::function<void(BasicSolver&)> helper_search_;
+    uint64_t helper_round_;
+    size_t helpers_running_;
+    bool helpers_exit_;
+
+    // Number of entries of a table of tt_mib MiB. Checks the arguments of
+    // the constructor before the table, which may be shared, is created.
+    static size_t tableSize(int threads, size_t tt_mib) {
+        if (threads <= 0)
+            throw std::runtime_error("threads <= 0");
+        if (tt_mib < 8)
+            throw std::runtime_error("tt_mib < 8");
+        return (tt_mib << 20)
+            / (TranspositionTable::ENTRY_WORDS * sizeof(uint64_t));
+    }
+
+    BasicSolver(std::shared_ptr<TranspositionTable> table,
+                std::shared_ptr<const Book> book,
+                const std::atomic<bool>* stop, int helper_index)
+            : num_explored_pos_(0), symmetric_(false),
+              max_score_table_(table), book_(book),
+              stop_flag_(false), search_id_(0), cancelled_id_(0),
+              searching_(false), node_limit_(UINT64_MAX),
+              stop_(stop ? stop : &stop_flag_), helper_round_(0),
+              helpers_running_(0), helpers_exit_(false) {
+        // Explore columns from the middle first. Helpers use a rotated order
+        // so that they do not all walk the same subtree as the main search.
+        for (int i = 0; i < Board::WIDTH; ++i) {
+            int j = (i + helper_index) % Board::WIDTH;
+            column_order_[i] = Board::WIDTH / 2
+                + (1 - 2 * (j % 2)) * (j + 1) / 2;
+        }
+    }
+
+    // Runs search(solver) on this solver and, in other threads, on all the
+    // helpers. Returns the result of this solver's search; the helpers are
+    // then interrupted. All the searches are also interrupted at deadline.
+    template <class Search>
+    auto withHelpers(Search search,
+                     std::chrono::steady_clock::time_point deadline =
+                         std::chrono::steady_clock::time_point::max())
+            -> decltype(search(*this)) {
+        max_score_table_->newSearch();
+        stats_.iteration_seconds.clear();
+        {
+            // Only the cancellations of this search apply to it.
+            std::lock_guard<std::mutex> lock(cancel_mutex_);
+            ++search_id_;
+            searching_ = true;
+            stop_flag_.store(cancelled_id_ >= search_id_);
+        }
+        for (auto& helper : helpers_)
+            helper->stats_.iteration_seconds.clear();
+        if (!helpers_.empty()) {
+            std::lock_guard<std::mutex> lock(helper_mutex_);
+            helper_search_ = [&search](BasicSolver& h) { search(h); };
+            helpers_running_ = helpers_.size();
+            ++helper_round_;
+            helper_wake_.notify_all();
+        }
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::condition_variable search_done;
+        bool done = false;
+        if (deadline != std::chrono::steady_clock::time_point::max()) {
+            threads.emplace_back([&]() {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (!search_done.wait_until(lock, deadline,
+                                            [&done]() { return done; }))
+                    stop_flag_.store(true);
+            });
+        }
+        auto result = search(*this);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+        }
+        search_done.notify_all();
+        stop_flag_.store(true);
+        for (auto& thread : threads)
+            thread.join();
+        if (!helpers_.empty()) {
+            std::unique_lock<std::mutex> lock(helper_mutex_);
+            helper_done_.wait(lock, [this]() { return helpers_running_ == 0; });
+        }
+        std::lock_guard<std::mutex> lock(cancel_mutex_);
+        searching_ = false;
+        stop_flag_.store(false);
+        return result;
+    }
+
+    // Thread of a helper: runs its part of each search.
+    void runHelper(BasicSolver* helper) {
+        uint64_t round = 0;
+        for (;;) {
+            std::function<void(BasicSolver&)> search;
+            {
+                std::unique_lock<std::mutex> lock(helper_mutex_);
+                helper_wake_.wait(lock, [this, round]() {
+                    return helpers_exit_ || helper_round_ != round; });
+                if (helpers_exit_)
+                    return;
+                round = helper_round_;
+                search = helper_search_;
+            }
+            search(*helper);
+            std::lock_guard<std::mutex> lock(helper_mutex_);
+            if (--helpers_running_ == 0)
+                helper_done_.notify_all();
+        }
+    }
+
+    int dichotomicSearch(const Board& B, bool use_weak_solver) {
+        // Check board status.
+        if (B.getStatus() != Board::Status::InProgress)
+            return finishedScore(B);
+
+        // The weak solver only narrows the score down to its sign, with the
+        // same search and table: sign-only entries would be half as large,
+        // but would leave no room for the number of moves, which the
+        // replacement of the table entries needs far more.
+        if (use_weak_solver)
+            return dichotomicSearch(B, -1, 1);
+        return dichotomicSearch(B, minScore(B), maxScore(B));
+    }
+
+    // Lowest and highest possible scores of a board in progress.
+    static int minScore(const Board& B) {
+        return -(Board::WIDTH * Board::HEIGHT - B.getMoves()) / 2;
+    }
+
+    static int maxScore(const Board& B) {
+        return (1 + Board::WIDTH * Board::HEIGHT - B.getMoves()) / 2;
+    }
+
+    // Key of the table entry of a board.
+    Word tableKey(Word key) const {
+        return symmetric_ ? std::min(key, Board::mirrorKey(key)) : key;
+    }
+
+    // Column of the mirror image if mirrored (-1 staying -1).
+    static int mirrorMove(int move, bool mirrored) {
+        return mirrored && move >= 0 ? Board::WIDTH - 1 - move : move;
+    }
+
+    // Score of a board in progress, known to be in [min_score, max_score].
+    int dichotomicSearch(const Board& B, int min_score, int max_score) {
+        narrowScore(B, min_score, max_score);
+        return min_score;
+    }
+
+    // Narrows [min_score, max_score], known to contain the score of a board
+    // in progress, down to the score unless the search is interrupted. With
+    // best_move, the move reaching min_score is stored there whenever
+    // min_score is raised.
+    void narrowScore(const Board& B, int& min_score, int& max_score,
+                     int* best_move = nullptr) {
+        while (min_score < max_score) {
+            int med_score = min_score + (max_score - min_score) / 2;
+            if (med_score <= 0 && med_score > min_score / 2)
+                med_score = min_score / 2;
+            else if (med_score >= 0 && med_score < max_score / 2)
+                med_score = max_score / 2;
+
+            // Only search if the actual score is greater or smaller.
+            auto start = std::chrono::steady_clock::now();
+            int move = -1;
+            int null_window_score = negamax(B, med_score, med_score + 1,
+                                            best_move ? &move : nullptr);
+            stats_.iterations++;
+            stats_.iteration_seconds.push_back(
+                std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start).count());
+            if (stop_->load(std::memory_order_relaxed))
+                break;
+            // The score returned outside of the window is a bound, which
+            // can be tighter than the window when found in the table.
+            if (null_window_score <= med_score) {
+                max_score = std::max(min_score, null_window_score);
+            } else {
+                min_score = std::min(max_score, null_window_score);
+                if (best_move && move >= 0)
+                    *best_move = move;
+            }
+        }
+    }
+
+    SolveResult boundedSearch(const Board& B, bool use_weak_solver) {
+        SolveResult result;
+        result.best_move = -1;
+        if (B.getStatus() != Board::Status::InProgress) {
+            result.min_score = result.max_score = finishedScore(B);
+            return result;
+        }
+        result.min_score = use_weak_solver ? -1 : minScore(B);
+        result.max_score = use_weak_solver ? 1 : maxScore(B);
+        // Any move reaches the lowest score.
+        for (int i = 0; i < Board::WIDTH && result.best_move < 0; ++i) {
+            if (B.canPlay(column_order_[i]))
+                result.best_move = column_order_[i];
+        }
+        narrowScore(B, result.min_score, result.max_score, &result.best_move);
+        return result;
+    }
+
+    std::vector<int> analyzeSearch(const Board& B, bool best_only) {
+        std::vector<int> scores(Board::WIDTH, INVALID_SCORE);
+        if (B.getStatus() != Board::Status::InProgress)
+            return scores;
+        int best_score = dichotomicSearch(B, false);
+        for (int i = 0; i < Board::WIDTH; ++i) {
+            int col = column_order_[i];
+            if (!B.canPlay(col))
+                continue;
+            if (B.isWinningMove(col)) {
+                scores[col] = maxScore(B);
+            } else {
+                Board B2(B);
+                B2.play(col);
+                if (B2.getStatus() != Board::Status::InProgress) {
+                    scores[col] = -finishedScore(B2);
+                } else if (best_only) {
+                    // Null window: does this column reach best_score?
+                    if (-negamax(B2, -best_score, -best_score + 1)
+                            >= best_score)
+                        scores[col] = best_score;
+                } else {
+                    // Playing this column cannot do better than best_score.
+                    scores[col] = -dichotomicSearch(
+                        B2, std::max(minScore(B2), -best_score),
+                        maxScore(B2));
+                }
+            }
+            if (stop_->load(std::memory_order_relaxed))
+                break;
+            if (best_only && scores[col] == best_score)
+                break;
+        }
+        return scores;
+    }
+
+    // Moves sorted by decreasing score, moves with the same score staying in
+    // insertion order. Insertion sort in a fixed-size array: no allocation.
+    class MoveSorter {
+    public:
+        struct Entry {
+            int move;
+            int score;
+        };
+
+        MoveSorter() : size_(0) {}
+
+        void add(int move, int score) {
+            int pos = size_++;
+            for (; pos > 0 && entries_[pos - 1].score < score; --pos)
+                entries_[pos] = entries_[pos - 1];
+            entries_[pos].move = move;
+            entries_[pos].score = score;
+        }
+
+        const Entry* begin() const {
+            return entries_;
+        }
+
+        const Entry* end() const {
+            return entries_ + size_;
+        }
+
+    private:
+        Entry entries_[Board::WIDTH];
+        int size_;
+    };
+};
+
+
+template <int W, int H, class Word>
+const int BasicSolver<W, H, Word>::INVALID_SCORE;
+
+typedef BasicSolver<Board::WIDTH, Board::HEIGHT> Solver;
+
+
+// Proof-number search, in its depth-first variant (df-pn): proves or
+// disproves that a player (the attacker) wins. The proof number of a
+// position is the minimum number of unsolved positions below it to prove
+// for it to be proven, and its disproof number the minimum number to
+// disprove. The search always expands the position closest to a proof or a
+// disproof, and only finds the sign of the score, but needs far fewer
+// positions than alpha-beta when the game is decided by a few forcing
+// lines. The numbers of the positions are kept in a table of bounded size,
+// the positions with the smallest subtrees being replaced first.
+template <int W, int H, class Word = typename BoardWord<W, H>::type>
+class BasicPNSolver {
+public:
+    typedef BasicBoard<W, H, Word> Board;
+
+    // Returned by solve() when out of nodes.
+    static const int INVALID_SCORE = 127;
+
+    BasicPNSolver(size_t tt_mib = 64) : num_explored_pos_(0) {
+        if (tt_mib <= 0)
+            throw std::runtime_error("tt_mib <= 0");
+        num_buckets_ = std::max<size_t>(
+            1, (tt_mib << 20) / (BUCKET_SIZE * sizeof(Entry)));
+        table_.resize(num_buckets_ * BUCKET_SIZE);
+        for (int i = 0; i < W; ++i)
+            column_order_[i] = W / 2 + (1 - 2 * (i % 2)) * (i + 1) / 2;
+    }
+
+    // Sign of the score of B: 1 if the current player wins, -1 if the
+    // opponent wins, 0 for a draw. Gives up with INVALID_SCORE once
+    // max_nodes positions (0 for no limit) have been expanded: a win of the
+    // current player is searched first, then a win of the opponent.
+    int solve(const Board& B, uint64_t max_nodes = 0) {
+        if (B.getStatus() != Board::Status::InProgress)
+            return BasicSolver<W, H, Word>::finishedScore(B) < 0 ? -1 : 0;
+        node_limit_ = max_nodes == 0 ? UINT64_MAX
+                                     : num_explored_pos_ + max_nodes;
+        Numbers win = prove(B, true);
+        if (win.pn == 0)
+            return 1;
+        if (win.dn != 0)
+            return INVALID_SCORE;
+        Numbers loss = prove(B, false);
+        if (loss.pn == 0)
+            return -1;
+        return loss.dn == 0 ? 0 : INVALID_SCORE;
+    }
+
+    uint64_t getNumExploredPos() const {
+        return num_explored_pos_;
+    }
+
+    void reset() {
+        num_explored_pos_ = 0;
+        std::fill(table_.begin(), table_.end(), Entry());
+    }
+
+private:
+    // Numbers of a solved position.
+    static const uint32_t INF = 1u << 30;
+
+    struct Numbers {
+        uint32_t pn;
+        uint32_t dn;
+    };
+
+    // Keyed by the board and by who the attacker is (the player to move
+    // at an even number of moves or not). Empty when work is 0.
+    struct Entry {
+        Word key;
+        Numbers numbers;
+        uint32_t work;
+        bool attacker_first;
+
+        Entry() : key(0), numbers(), work(0), attacker_first(false) {}
+    };
+    static const int BUCKET_SIZE = 4;
+
+    struct Child {
+        Board board;
+        Numbers numbers;
+    };
+
+    uint64_t num_explored_pos_;
+    uint64_t node_limit_;
+    std::vector<Entry> table_;
+    size_t num_buckets_;
+    int column_order_[W];
+
+    // attacking: whether the player to move in B is the attacker.
+    Numbers prove(const Board& B, bool attacking) {
+        Numbers numbers;
+        if (!evaluate(B, attacking, numbers))
+            search(B, attacking, INF, INF, numbers);
+        return numbers;
+    }
+
+    // Numbers of a position, solved right away when the game ends within
+    // a move. Otherwise, numbers from the table or initial ones, based on
+    // the number of moves of the player to move (squared, which works better
+    // than the plain number); returns false.
+    bool evaluate(const Board& B, bool attacking, Numbers& numbers) const {
+        static const Numbers proven = {0, INF}, disproven = {INF, 0};
+        if (B.getStatus() == Board::Status::Draw) {
+            numbers = disproven;
+            return true;
+        }
+        if (B.canWinNext()) {
+            numbers = attacking ? proven : disproven;
+            return true;
+        }
+        Word next = B.candidatesMask();
+        if (next == 0) {
+            numbers = attacking ? disproven : proven;
+            return true;
+        }
+        if (find(B, attacking, numbers))
+            return false;
+        uint32_t moves = 0;
+        for (int col = 0; col < W; ++col)
+            moves += (next & Board::columnMask(col)) != 0;
+        numbers.pn = attacking ? 1 : moves * moves;
+        numbers.dn = attacking ? moves * moves : 1;
+        return false;
+    }
+
+    // Expands B, not solved within a move and with numbers below the
+    // thresholds, until one of its numbers reaches its threshold (or until
+    // out of nodes).
+    void search(const Board& B, bool attacking, uint32_t pn_threshold,
+                uint32_t dn_threshold, Numbers& numbers) {
+        uint64_t start = num_explored_pos_++;
+        Child children[W];
+        int num_children = 0;
+        Word next = B.candidatesMask();
+        for (int i = 0; i < W; ++i) {
+            int col = column_order_[i];
+            if (next & Board::columnMask(col)) {
+                Child& child = children[num_children++];
+                child.board = B;
+                child.board.play(col, false);
+                evaluate(child.board, !attacking, child.numbers);
+            }
+        }
+
+        for (;;) {
+            // The attacker needs to prove one of their moves, and to
+            // disprove all the moves of the defender.
+            numbers = combine(children, num_children, attacking);
+            if (numbers.pn >= pn_threshold || numbers.dn >= dn_threshold
+                    || num_explored_pos_ >= node_limit_)
+                break;
+            // Expand the child with the smallest proof number for the
+            // attacker (disproof number for the defender), until it exceeds
+            // the second smallest one (by a margin, so as not to switch back
+            // and forth between close children) or the threshold of this
+            // position.
+            int best = 0;
+            uint32_t second = INF;
+            for (int i = 1; i < num_children; ++i) {
+                uint32_t n = attacking ? children[i].numbers.pn
+                                       : children[i].numbers.dn;
+                uint32_t best_n = attacking ? children[best].numbers.pn
+                                            : children[best].numbers.dn;
+                if (n < best_n) {
+                    second = best_n;
+                    best = i;
+                } else if (n < second) {
+                    second = n;
+                }
+            }
+            Numbers& child = children[best].numbers;
+            uint64_t pn_child_threshold, dn_child_threshold;
+            if (attacking) {
+                pn_child_threshold = std::min<uint64_t>(
+                    pn_threshold, second + second / 4 + 1);
+                dn_child_threshold =
+                    uint64_t(dn_threshold) - numbers.dn + child.dn;
+            } else {
+                pn_child_threshold =
+                    uint64_t(pn_threshold) - numbers.pn + child.pn;
+                dn_child_threshold = std::min<uint64_t>(
+                    dn_threshold, second + second / 4 + 1);
+            }
+            search(children[best].board, !attacking,
+                   std::min<uint64_t>(pn_child_threshold, INF),
+                   std::min<uint64_t>(dn_child_threshold, INF), child);
+        }
+        store(B, attacking, numbers, num_explored_pos_ - start);
+    }
+
+    // Numbers of a position from the ones of its children. Sums are capped
+    // below INF, which only marks solved positions.
+    static Numbers combine(const Child* children, int num_children,
+                           bool attacking) {
+        uint32_t min = INF;
+        uint64_t sum = 0;
+        for (int i = 0; i < num_children; ++i) {
+            const Numbers& n = children[i].numbers;
+            min = std::min(min, attacking ? n.pn : n.dn);
+            sum += attacking ? n.dn : n.pn;
+        }
+        uint32_t capped_sum = min == 0 ? INF
+            : static_cast<uint32_t>(std::min<uint64_t>(sum, INF - 1));
+        Numbers numbers;
+        numbers.pn = attacking ? min : capped_sum;
+        numbers.dn = attacking ? capped_sum : min;
+        return numbers;
+    }
+
+    bool attackerFirst(const Board& B, bool attacking) const {
+        return (B.getMoves() % 2 == 0) == attacking;
+    }
+
+    Entry* bucket(Word key) {
+        return &table_[static_cast<size_t>(key % num_buckets_) * BUCKET_SIZE];
+    }
+
+    bool find(const Board& B, bool attacking, Numbers& numbers) const {
+        Word key = B.key();
+        bool attacker_first = attackerFirst(B, attacking);
+        const Entry* entries = const_cast<BasicPNSolver*>(this)->bucket(key);
+        for (int i = 0; i < BUCKET_SIZE; ++i) {
+            if (entries[i].work != 0 && entries[i].key == key
+                    && entries[i].attacker_first == attacker_first) {
+                numbers = entries[i].numbers;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void store(const Board& B, bool attacking, const Numbers& numbers,
+               uint64_t work) {
+        Word key = B.key();
+        bool attacker_first = attackerFirst(B, attacking);
+        Entry* entries = bucket(key);
+        Entry* victim = &entries[0];
+        for (int i = 0; i < BUCKET_SIZE; ++i) {
+            if (entries[i].work == 0 || (entries[i].key == key
+                    && entries[i].attacker_first == attacker_first)) {
+                victim = &entries[i];
+                break;
+            }
+            if (entries[i].work < victim->work)
+                victim = &entries[i];
+        }
+        victim->key = key;
+        victim->numbers = numbers;
+        victim->work = static_cast<uint32_t>(
+            std::min<uint64_t>(work, UINT32_MAX));
+        victim->attacker_first = attacker_first;
+    }
+};
+
+template <int W, int H, class Word>
+const int BasicPNSolver<W, H, Word>::INVALID_SCORE;
+
+typedef BasicPNSolver<Board::WIDTH, Board::HEIGHT> PNSolver;
+
+
+// Number of worker threads to use: threads == 0 means one per hardware core.
+inline int numWorkers(int threads) {
+    if (threads < 0)
+        throw std::runtime_error("threads < 0");
+    if (threads == 0)
+        return std::max(1u, std::thread::hardware_concurrency());
+    return threads;
+}
+
+
+// Scores many boards at once, spreading them over a pool of threads. Each
+// worker has its own Solver (and transposition table), which is kept from one
+// board to the next since the table entries do not depend on the root
+// position. threads == 0 uses one thread per hardware core.
+inline std::vector<int8_t> solveMany(
+        const std::vector<Board>& boards, bool use_weak_solver, int threads,
+        size_t tt_mib = 64, std::shared_ptr<const OpeningBook> book = nullptr) {
+    threads = std::max(1, std::min<int>(numWorkers(threads), boards.size()));
+
+    std::vector<int8_t> scores(boards.size());
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        Solver solver(1, tt_mib, book);
+        for (size_t i = next++; i < boards.size(); i = next++)
+            scores[i] = solver.dichotomicSolve(boards[i], use_weak_solver);
+    };
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads; ++i)
+        workers.emplace_back(work);
+    work();
+    for (auto& worker : workers)
+        worker.join();
+    return scores;
+}
+
+
+// Writes the unique positions in progress after at most max_depth moves (a
+// position and its mirror image counting once) with their scores, as a NumPy
+// .npy array of fixed-width records:
+//   key          uint64        Board::canonicalKey()
+//   moves        int8
+//   score        int8          as Solver::dichotomicSolve()
+//   move_scores  int8[WIDTH]   as Solver::analyze(), INVALID_SCORE for the
+//                              columns that cannot be played
+// The positions are enumerated depth by depth. The next depth is split by a
+// hash of the keys into partitions, each deduplicated by a single thread, so
+// that only the keys of two depths are in memory. The records are appended
+// to the file as they are scored, in no particular order within a depth.
+// Each worker has its own Solver, as in solveMany(). Returns the number of
+// records.
+inline size_t exportPositions(
+        const std::string& filename, int max_depth, int threads = 0,
+        size_t tt_mib = 64, std::shared_ptr<const OpeningBook> book = nullptr) {
+    if (max_depth < 0 || max_depth > Board::WIDTH * Board::HEIGHT)
+        throw std::runtime_error("Invalid depth.");
+    threads = numWorkers(threads);
+    const size_t num_partitions = 16 * threads;
+    auto partition = [num_partitions](uint64_t key) {
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32)
+            % num_partitions;
+    };
+    const size_t record_size = sizeof(uint64_t) + 2 + Board::WIDTH;
+
+    // The shape is only known at the end, so the header has a fixed size
+    // and is written again with it.
+    auto header = [](size_t size) {
+        std::ostringstream os;
+        os << "{'descr': [('key', '<u8'), ('moves', 'i1'), ('score', 'i1'), "
+           << "('move_scores', 'i1', (" << Board::WIDTH << ",))], "
+           << "'fortran_order': False, 'shape': (" << size << ",), }";
+        std::string dict = os.str();
+        dict.resize(256 - 10 - 1, ' ');
+        dict += '\n';
+        std::string rv("\x93NUMPY\x01\x00", 8);
+        rv += static_cast<char>(dict.size() & 0xFF);
+        rv += static_cast<char>(dict.size() >> 8);
+        return rv + dict;
+    };
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    file << header(0);
+    if (!file)
+        throw std::runtime_error("Cannot write " + filename);
+
+    auto run = [threads](const std::function<void(int)>& work) {
+        std::vector<std::thread> workers;
+        for (int i = 1; i < threads; ++i)
+            workers.emplace_back(work, i);
+        work(0);
+        for (auto& worker : workers)
+            worker.join();
+    };
+    std::vector<std::unique_ptr<Solver>> solvers(threads);
+    for (auto& solver : solvers)
+        solver.reset(new Solver(1, tt_mib, book));
+    std::mutex mutex;
+    size_t num_records = 0;
+
+    std::vector<std::vector<uint64_t>> level(num_partitions);
+    level[partition(Board().canonicalKey())].push_back(
+        Board().canonicalKey());
+    for (int depth = 0; depth <= max_depth; ++depth) {
+        // Scores this depth and expands it, into partitions of each worker.
+        std::vector<std::vector<std::vector<uint64_t>>> children(threads);
+        std::atomic<size_t> next(0);
+        run([&](int worker) {
+            std::vector<std::vector<uint64_t>>& out = children[worker];
+            if (depth < max_depth)
+                out.resize(num_partitions);
+            std::vector<char> buffer;
+            auto flush = [&]() {
+                std::lock_guard<std::mutex> lock(mutex);
+                file.write(buffer.data(), buffer.size());
+                num_records += buffer.size() / record_size;
+                buffer.clear();
+            };
+            for (size_t p = next++; p < num_partitions; p = next++) {
+                for (uint64_t key : level[p]) {
+                    Board B(key);
+                    std::vector<int> scores = solvers[worker]->analyze(B);
+                    int score = -Board::WIDTH * Board::HEIGHT;
+                    for (int s : scores) {
+                        if (s != Solver::INVALID_SCORE)
+                            score = std::max(score, s);
+                    }
+                    char record[sizeof(uint64_t) + 2 + Board::WIDTH];
+                    std::memcpy(record, &key, sizeof(key));
+                    record[sizeof(key)] = static_cast<char>(B.getMoves());
+                    record[sizeof(key) + 1] = static_cast<char>(score);
+                    for (int col = 0; col < Board::WIDTH; ++col)
+                        record[sizeof(key) + 2 + col] =
+                            static_cast<char>(scores[col]);
+                    buffer.insert(buffer.end(), record, record + record_size);
+                    if (buffer.size() >= (1 << 16))
+                        flush();
+
+                    if (depth == max_depth)
+                        continue;
+                    for (int col = 0; col < Board::WIDTH; ++col) {
+                        if (!B.canPlay(col))
+                            continue;
+                        Board B2(B);
+                        B2.play(col);
+                        if (B2.getStatus() == Board::Status::InProgress) {
+                            uint64_t key2 = B2.canonicalKey();
+                            out[partition(key2)].push_back(key2);
+                        }
+                    }
+                }
+                std::vector<uint64_t>().swap(level[p]);
+            }
+            flush();
+        });
+        std::cout << num_records << " positions of up to " << depth
+                  << " moves" << std::endl;
+        if (depth == max_depth)
+            break;
+
+        // Deduplicates the next depth, one partition at a time.
+        next = 0;
+        run([&](int) {
+            for (size_t p = next++; p < num_partitions; p = next++) {
+                std::vector<uint64_t>& keys = level[p];
+                for (auto& out : children) {
+                    keys.insert(keys.end(), out[p].begin(), out[p].end());
+                    std::vector<uint64_t>().swap(out[p]);
+                }
+                std::sort(keys.begin(), keys.end());
+                keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+            }
+        });
+    }
+
+    file.seekp(0);
+    file << header(num_records);
+    file.close();
+    if (!file)
+        throw std::runtime_error("Cannot write " + filename);
+    return num_records;
+}
+
+
+// Analyzes boards (as Solver::analyze()) in a background thread, ahead of
+// the requests: while a player thinks about a board, ponder() computes the
+// analysis of the boards after each of its moves. The results are cached,
+// so that analyze() returns at once for the boards already pondered.
+class Ponderer {
+public:
+    Ponderer(int threads = 1, size_t tt_mib = 64,
+             std::shared_ptr<const OpeningBook> book = nullptr)
+            : solver_(threads, tt_mib, book), current_is_request_(false),
+              running_(false), cancelled_(false), stopping_(false),
+              current_search_(0), num_cancelled_(0),
+              thread_(&Ponderer::work, this) {}
+
+    ~Ponderer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+            if (running_)
+                cancelCurrent();
+            changed_.notify_all();
+        }
+        thread_.join();
+    }
+
+    Ponderer(const Ponderer&) = delete;
+    Ponderer& operator=(const Ponderer&) = delete;
+
+    // Analysis of B, from the cache or else computed before any pondering.
+    std::vector<int> analyze(const Board& B) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto found = cache_.find(B.key());
+        if (found != cache_.end())
+            return found->second;
+        if (running_ && !cancelled_ && B.key() == current_.key()) {
+            // Already being pondered: wait for it, and do not let ponder()
+            // cancel it.
+            current_is_request_ = true;
+        } else {
+            requests_.push_back(B);
+            if (running_ && !current_is_request_) {
+                // Pondering resumes afterwards with the same board.
+                pondering_.insert(pondering_.begin(), current_);
+                cancelCurrent();
+            }
+            changed_.notify_all();
+        }
+        changed_.wait(lock, [this, &B]() {
+            return cache_.find(B.key()) != cache_.end(); });
+        return cache_[B.key()];
+    }
+
+    // Replaces the pending pondering by the analysis of the boards after
+    // each move from B, the best moves first if B was analyzed. The
+    // pondering in progress is cancelled unless it is one of them.
+    void ponder(const Board& B) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int order[Board::WIDTH];
+        for (int i = 0; i < Board::WIDTH; ++i)
+            order[i] = Board::WIDTH / 2 + (1 - 2 * (i % 2)) * (i + 1) / 2;
+        auto found = cache_.find(B.key());
+        if (found != cache_.end()) {
+            // Unplayable columns have the highest score, INVALID_SCORE, but
+            // are skipped below.
+            const std::vector<int>& scores = found->second;
+            std::stable_sort(order, order + Board::WIDTH,
+                             [&scores](int a, int b) {
+                                 return scores[a] > scores[b]; });
+        }
+        pondering_.clear();
+        bool keep_current = current_is_request_;
+        for (int col : order) {
+            if (!B.canPlay(col))
+                continue;
+            Board B2(B);
+            B2.play(col);
+            if (running_ && B2.key() == current_.key())
+                keep_current = true;
+            else if (cache_.find(B2.key()) == cache_.end())
+                pondering_.push_back(B2);
+        }
+        if (running_ && !keep_current)
+            cancelCurrent();
+        changed_.notify_all();
+    }
+
+    // Whether the analysis of B is cached.
+    bool isCached(const Board& B) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return cache_.find(B.key()) != cache_.end();
+    }
+
+    size_t cacheSize() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return cache_.size();
+    }
+
+    // Number of analyses cancelled before they completed.
+    uint64_t getNumCancelled() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return num_cancelled_;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable changed_;
+    Solver solver_;
+    std::unordered_map<uint64_t, std::vector<int>> cache_;
+    // Boards to analyze: the ones requested by analyze() first.
+    std::vector<Board> requests_;
+    std::vector<Board> pondering_;
+    // Board being analyzed, if running.
+    Board current_;
+    bool current_is_request_;
+    bool running_;
+    bool cancelled_;
+    bool stopping_;
+    // Id of the search of current_, which may not have started yet.
+    uint64_t current_search_;
+    uint64_t num_cancelled_;
+    std::thread thread_;
+
+    // With the mutex held.
+    void cancelCurrent() {
+        cancelled_ = true;
+        ++num_cancelled_;
+        solver_.cancel(current_search_);
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            changed_.wait(lock, [this]() {
+                return stopping_ || !requests_.empty() || !pondering_.empty();
+            });
+            if (stopping_)
+                return;
+            std::vector<Board>& queue =
+                requests_.empty() ? pondering_ : requests_;
+            current_is_request_ = !requests_.empty();
+            current_ = queue.front();
+            queue.erase(queue.begin());
+            if (cache_.find(current_.key()) != cache_.end())
+                continue;
+            running_ = true;
+            cancelled_ = false;
+            current_search_ = solver_.nextSearchId();
+            Board B = current_;
+            lock.unlock();
+            std::vector<int> scores = solver_.analyze(B);
+            lock.lock();
+            running_ = false;
+            if (!cancelled_)
+                cache_[B.key()] = scores;
+            changed_.notify_all();
+        }
+    }
+};
+
+
+// OpeningBook generation, which needs the Solver.
+inline OpeningBook::OpeningBook(size_t depth, int threads,
+                                std::string checkpoint)
+        : depth_(depth), weak_(false), blocks_(nullptr), num_blocks_(0) {
+    std::cout << "Will now generate opening book for depth "
+        << depth << "." << std::endl;
+    std::cout << "This will take some time..." << std::endl;
+    std::unordered_map<uint64_t, int8_t> frontier_scores =
+        solveFrontier(numWorkers(threads), checkpoint);
+    std::unordered_map<uint64_t, int8_t> book;
+    backup(Board(), book, frontier_scores);
+    setEntries(book);
+}
+
+
+inline std::unordered_map<uint64_t, int8_t> OpeningBook::solveFrontier(
+        int threads, const std::string& checkpoint) const {
+    std::vector<uint64_t> frontier = enumerateFrontier();
+    std::unordered_map<uint64_t, int8_t> scores =
+        readCheckpoint(checkpoint);
+    std::vector<uint64_t> todo;
+    for (uint64_t key : frontier) {
+        if (scores.find(key) == scores.end())
+            todo.push_back(key);
+    }
+    std::cout << frontier.size() << " unique positions at depth "
+              << depth_ << ", " << frontier.size() - todo.size()
+              << " already solved." << std::endl;
+
+    // Rewrite the checkpoint without a possibly truncated last record
+    // before appending to it. The new file replaces the old one only once
+    // complete, so that an interruption keeps one of them.
+    std::ofstream file;
+    if (!checkpoint.empty()) {
+        std::string tmp = checkpoint + ".tmp";
+        file.open(tmp, std::ios::binary | std::ios::trunc);
+        for (const auto& kv : scores) {
+            file.write(reinterpret_cast<const char *>(&kv.first),
+                       sizeof(kv.first));
+            file.write(reinterpret_cast<const char *>(&kv.second),
+                       sizeof(kv.second));
+        }
+        file.close();
+        if (!file || !replaceFile(tmp, checkpoint))
+            throw std::runtime_error("Cannot write " + checkpoint);
+        file.open(checkpoint, std::ios::binary | std::ios::app);
+    }
+    std::mutex mutex;
+    size_t num_solved = 0;
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        Solver solver;
+        for (size_t i = next++; i < todo.size(); i = next++) {
+            int8_t score = solver.dichotomicSolve(Board(todo[i]));
+            std::lock_guard<std::mutex> lock(mutex);
+            scores[todo[i]] = score;
+            if (file.is_open()) {
+                file.write(reinterpret_cast<const char *>(&todo[i]),
+                           sizeof(todo[i]));
+                file.write(reinterpret_cast<const char *>(&score),
+                           sizeof(score));
+            }
+            ++num_solved;
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_checkpoint > std::chrono::seconds(10)
+                    || num_solved == todo.size()) {
+                file.flush();
+                last_checkpoint = now;
+                std::cout << "solved " << num_solved << "/" << todo.size()
+                          << " positions" << std::endl;
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int i = 1; i < std::min<int>(threads, todo.size()); ++i)
+        workers.emplace_back(work);
+    work();
+    for (auto& worker : workers)
+        worker.join();
+    return scores;
+}
+
+
+inline int8_t OpeningBook::backup(
+        const Board& B, std::unordered_map<uint64_t, int8_t>& book,
+        const std::unordered_map<uint64_t, int8_t>& frontier_scores) {
+    // Return now if already computed (considering symmetric Board).
+    auto found = book.find(B.key());
+    if (found != book.end())
+        return found->second;
+    found = book.find(B.symmetricKey());
+    if (found != book.end())
+        return found->second;
+
+    int8_t score;
+    if (B.getStatus() != Board::Status::InProgress) {
+        // Handle finished game.
+        score = Solver::finishedScore(B);
+    } else if ((unsigned)B.getMoves() < depth_) {
+        score = -Board::WIDTH * Board::HEIGHT - 2; // lower bound
+        for (int col = 0; col < Board::WIDTH; ++col) {
+            if (B.canPlay(col)) {
+                Board B2(B);
+                B2.play(col);
+                int8_t play_score = -backup(B2, book, frontier_scores);
+                if (score < play_score)
+                    score = play_score;
+            }
+        }
+    } else {
+        score = frontier_scores.at(B.canonicalKey());
+    }
+
+    book[B.key()] = score;
+    return score;
+}
+
+#endif  // CONNECTPY_CONNECTLIB_H